@@ -0,0 +1,147 @@
+// Benchmarks of the core's hot paths on deterministic synthetic data (see
+// `src/synth.rs`).
+//
+//     cd rust && cargo bench --features bench     # everything
+//     cargo bench --features bench -- realign     # one group
+//
+// Every input is regenerated from fixed seeds, so runs on one machine are
+// comparable across commits.  `analyze` is benchmarked with and without
+// profiling to keep the instrumentation overhead in view.
+
+use std::hint::black_box;
+use std::path::Path;
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+
+use _core::bench::{
+    analyze, fraction_from_positions, region_coverage, simulate, trinucleotide_entropy, write,
+    IoConfig, Realigner, SynthParams,
+};
+
+const PAD: i64 = 30;
+const INDEL: i64 = 10_000;
+const MIN_ENTROPY: f64 = 50.0;
+
+/// A written synthetic sample and the BWA index of its reference.
+struct Fixture {
+    _dir: tempfile::TempDir,
+    chrom: String,
+    len: i64,
+    fasta: String,
+    bam: String,
+    reads: Vec<Vec<u8>>,
+    clipped: Vec<Vec<u8>>,
+}
+
+impl Fixture {
+    fn new(params: SynthParams) -> Self {
+        let sample = simulate(&params);
+        let dir = tempfile::tempdir().unwrap();
+        let files = write(&sample, dir.path()).unwrap();
+        let path = |p: &Path| p.to_str().unwrap().to_string();
+        let clipped = sample
+            .reads
+            .iter()
+            .filter(|r| r.cigar.len() > 1)
+            .map(|r| r.seq.clone())
+            .collect();
+        Self {
+            chrom: sample.chrom.clone(),
+            len: params.ref_len as i64,
+            fasta: path(&files.fasta),
+            bam: path(&files.bam),
+            reads: sample.reads.into_iter().map(|r| r.seq).collect(),
+            clipped,
+            _dir: dir,
+        }
+    }
+
+    fn realigner(&self) -> Realigner {
+        Realigner::from_reference(&self.fasta, &self.chrom, 0, self.len, "SYN").unwrap()
+    }
+}
+
+fn entropy(c: &mut Criterion) {
+    let sample = simulate(&SynthParams { depth: 5.0, ..SynthParams::default() });
+    let reads: Vec<&[u8]> = sample.reads.iter().map(|r| r.seq.as_slice()).collect();
+    let mut group = c.benchmark_group("trinucleotide_entropy");
+    group.throughput(Throughput::Elements(reads.len() as u64));
+    group.bench_function("reads", |b| {
+        b.iter(|| reads.iter().map(|r| trinucleotide_entropy(black_box(r))).sum::<f64>())
+    });
+    group.finish();
+}
+
+fn realign(c: &mut Criterion) {
+    let fixture = Fixture::new(SynthParams { depth: 10.0, clip_rate: 0.2, ..SynthParams::default() });
+    let realigner = fixture.realigner();
+    let queries: Vec<&[u8]> = fixture.clipped.iter().take(2_000).map(|r| r.as_slice()).collect();
+    let mut group = c.benchmark_group("realign");
+    group.throughput(Throughput::Elements(queries.len() as u64));
+    group.sample_size(20);
+    group.bench_function("align", |b| {
+        b.iter(|| queries.iter().map(|q| realigner.align(black_box(q)).len()).sum::<usize>())
+    });
+    for threads in [1, 4] {
+        group.bench_with_input(BenchmarkId::new("align_batch", threads), &threads, |b, &t| {
+            b.iter(|| realigner.align_batch(black_box(&queries), t))
+        });
+    }
+    group.finish();
+}
+
+fn coverage(c: &mut Criterion) {
+    let fixture = Fixture::new(SynthParams::default());
+    let (chrom, len) = (fixture.chrom.as_str(), fixture.len);
+    let mut group = c.benchmark_group("coverage");
+    group.throughput(Throughput::Elements(fixture.reads.len() as u64));
+    group.sample_size(20);
+    group.bench_function("region_coverage", |b| {
+        b.iter(|| region_coverage(&fixture.bam, chrom, 0, len, 1, IoConfig::default()).unwrap())
+    });
+
+    let track: Vec<(i64, u32)> =
+        region_coverage(&fixture.bam, chrom, 0, len, 1, IoConfig::default()).unwrap().iter().collect();
+    let fifth = len / 5;
+    group.throughput(Throughput::Elements(track.len() as u64));
+    group.bench_function("fraction_from_positions", |b| {
+        b.iter(|| {
+            fraction_from_positions(
+                black_box(track.iter().copied()),
+                (2 * fifth, 3 * fifth),
+                (0, 2 * fifth),
+                (3 * fifth, len),
+                1,
+                &[],
+            )
+        })
+    });
+    group.finish();
+}
+
+fn end_to_end(c: &mut Criterion) {
+    let mut group = c.benchmark_group("analyze");
+    group.sample_size(10);
+    for depth in [10.0, 40.0] {
+        let fixture = Fixture::new(SynthParams { depth, ..SynthParams::default() });
+        let realigner = fixture.realigner();
+        let (chrom, len) = (fixture.chrom.as_str(), fixture.len);
+        group.throughput(Throughput::Elements(fixture.reads.len() as u64));
+        for profile in [false, true] {
+            let id = if profile { "profiled" } else { "plain" };
+            group.bench_with_input(BenchmarkId::new(id, depth), &profile, |b, &profile| {
+                b.iter(|| {
+                    analyze(
+                        &fixture.bam, chrom, 0, len, PAD, INDEL, MIN_ENTROPY, &realigner, 1,
+                        IoConfig::default(), profile,
+                    )
+                    .unwrap()
+                })
+            });
+        }
+    }
+    group.finish();
+}
+
+criterion_group!(benches, entropy, realign, coverage, end_to_end);
+criterion_main!(benches);
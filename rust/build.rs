@@ -1,10 +1,13 @@
 // Compile a minimal subset of BWA-MEM's C source in-tree.
 //
-// We vendor `bwa/` from lh3/bwa (BSD-3) with two local tweaks:
+// We vendor `bwa/` from lh3/bwa (BSD-3) with three local tweaks:
 //   * ksw.c: `#include <emmintrin.h>` rewritten to `"splithunter_simd.h"` so
 //     the file compiles under Aarch64 (via sse2neon.h).
 //   * divsufsort.h: stubbed; bwtindex.c only takes that code path for
 //     references > 50 MB, which we never hit for V(D)J loci.
+//   * bwamem.c: `smem_aux_init` / `smem_aux_destroy` made non-static so the
+//     batched realigner can keep one seeding buffer per worker thread, the
+//     way `mem_process_seqs` does.
 
 const SOURCES: &[&str] = &[
     "vendor/bwa/utils.c",
@@ -8,15 +8,17 @@
 
 #![allow(non_camel_case_types)]
 
-use std::os::raw::{c_char, c_int, c_uchar, c_uint, c_ulong};
+use std::os::raw::{c_char, c_int, c_long, c_uchar, c_uint, c_ulong, c_void};
 
 // --- Opaque handles ---------------------------------------------------------
 #[repr(C)]
 pub struct bwt_t {
     _unused: [u8; 0],
 }
+/// `bntseq_t` from bwa/bntseq.h.  Only the leading `l_pac` is declared.
 #[repr(C)]
 pub struct bntseq_t {
+    pub l_pac: i64,
     _unused: [u8; 0],
 }
 #[repr(C)]
@@ -104,6 +106,11 @@ impl mem_aln_t {
 pub const BWA_IDX_ALL: c_int = 0x7;
 pub const BWTALGO_AUTO: c_int = 0;
 
+/// Version of the vendored lh3/bwa tree (`PACKAGE_VERSION` in bwa/main.c).
+/// Part of the on-disk index cache key: the flat index image produced by
+/// `bwa_idx2mem` is only valid for the struct layouts it was written with.
+pub const BWA_VERSION: &str = "0.7.16a-r1181";
+
 extern "C" {
     /// Build a BWA-MEM index at `prefix` from the given FASTA.  Returns 0 on
     /// success.  Writes `prefix.{bwt,pac,ann,amb,sa}` to disk.
@@ -118,9 +125,20 @@ extern "C" {
     /// and must free with `bwa_idx_destroy`.
     pub fn bwa_idx_load_from_disk(hint: *const c_char, which: c_int) -> *mut bwaidx_t;
 
-    /// Free a `bwaidx_t` returned by `bwa_idx_load_from_disk`.
+    /// Free a `bwaidx_t` returned by `bwa_idx_load_from_disk`.  When
+    /// `idx.mem` is set and `idx.is_shm` is non-zero the flat image is left
+    /// alone — the caller owns that mapping.
     pub fn bwa_idx_destroy(idx: *mut bwaidx_t);
 
+    /// Collapse a loaded index into a single contiguous allocation at
+    /// `idx.mem` (`idx.l_mem` bytes).  Returns 0 on success.
+    pub fn bwa_idx2mem(idx: *mut bwaidx_t) -> c_int;
+
+    /// Rebuild `idx` in place from a flat image written by `bwa_idx2mem`.
+    /// The BWT, SA, ambiguity table and PAC point straight into `mem`, so a
+    /// read-only mapping of the image is enough.  Returns 0 on success.
+    pub fn bwa_mem2idx(l_mem: i64, mem: *mut c_uchar, idx: *mut bwaidx_t) -> c_int;
+
     /// Allocate a default `mem_opt_t`.  Caller owns the returned pointer and
     /// must free with `libc::free`.
     pub fn mem_opt_init() -> *mut mem_opt_t;
@@ -137,6 +155,44 @@ extern "C" {
         seq: *const c_char,
     ) -> mem_alnreg_v;
 
+    /// Core of `mem_align1`: seeds, chains and extends `seq` in place (the
+    /// buffer is converted to 2-bit encoding).  `buf` is a seeding scratch
+    /// buffer from `smem_aux_init`, or null to allocate one per call.  Does
+    /// not mark primaries — follow with `mem_mark_primary_se`.
+    pub fn mem_align1_core(
+        opt: *const mem_opt_t,
+        bwt: *const bwt_t,
+        bns: *const bntseq_t,
+        pac: *const c_uchar,
+        l_seq: c_int,
+        seq: *mut c_char,
+        buf: *mut c_void,
+    ) -> mem_alnreg_v;
+
+    /// Mark secondary hits among `a[0..n]`.  `id` seeds the hash used to
+    /// break score ties, so a fixed id gives a reproducible primary.
+    pub fn mem_mark_primary_se(
+        opt: *const mem_opt_t,
+        n: c_int,
+        a: *mut mem_alnreg_t,
+        id: i64,
+    ) -> c_int;
+
+    /// Per-thread seeding scratch buffer for `mem_align1_core` (local tweak:
+    /// these are `static` upstream).
+    pub fn smem_aux_init() -> *mut c_void;
+    pub fn smem_aux_destroy(a: *mut c_void);
+
+    /// BWA's work-stealing parallel-for (kthread.c): calls
+    /// `func(data, i, tid)` for every `i` in `0..n` across `n_threads`
+    /// pthreads and returns once all iterations are done.
+    pub fn kt_for(
+        n_threads: c_int,
+        func: extern "C" fn(*mut c_void, c_long, c_int),
+        data: *mut c_void,
+        n: c_long,
+    );
+
     /// Convert an alignment region into a reportable `mem_aln_t` (includes
     /// CIGAR, mapq, NM, etc.).  Caller must free `aln.cigar` and `aln.XA` with
     /// `libc::free`.
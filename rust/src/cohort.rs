@@ -0,0 +1,192 @@
+// Native cohort scheduler: every (sample, locus) pair of a run is one task on
+// a single pool of worker threads.
+//
+// `splithunter_run` used to hand whole samples to a process pool, so a
+// process stuck on IGH or TRA left its other loci waiting while neighbours
+// idled, and every process loaded its own indexes.  Here all workers share
+// one `Realigner` per locus and claim tasks from a shared cursor: a worker
+// that finishes early simply takes the next pending task, whichever sample it
+// belongs to (the same self-scheduling `kt_for` uses for realignment).
+//
+// Tasks are ordered sample-major, largest locus first, so samples complete
+// roughly in input order and the slow loci start before the quick ones.  A
+// sample is sent down the result channel as soon as its last locus is done.
+// Each worker keeps the BAM of the sample it is on open, and since a
+// sample's tasks are adjacent it usually reuses that reader for the next
+// locus.  With prefetch on, each task's window is planned as it is fetched.
+
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::sync::mpsc::SyncSender;
+use std::sync::{Arc, Mutex};
+
+use rust_htslib::bam::record::Record;
+
+use crate::bamio::BamSource;
+use crate::realign::Realigner;
+use crate::sample::{self, LocusOutput, LocusSpec, ScanParams};
+use crate::split;
+
+pub struct SampleSpec {
+    pub key: String,
+    pub bam: String,
+    pub loci: Vec<LocusSpec>,
+    /// Index into the cohort's shared realigners, parallel to `loci`.
+    pub realigners: Vec<usize>,
+}
+
+pub struct SampleResult {
+    pub key: String,
+    /// `(locus name, output)` in the order the loci were given, or the
+    /// first error hit by any of the sample's tasks.
+    pub outputs: Result<Vec<(String, LocusOutput)>, String>,
+}
+
+struct Slot {
+    outputs: Vec<Option<LocusOutput>>,
+    remaining: usize,
+    error: Option<String>,
+}
+
+/// Run every task of the cohort on `workers` threads and send each sample's
+/// result to `tx` as it completes.  Returns early (after in-flight tasks)
+/// once the receiver is dropped.
+pub fn run(
+    samples: &[SampleSpec],
+    realigners: &[Arc<Realigner>],
+    params: ScanParams,
+    workers: usize,
+    tx: SyncSender<SampleResult>,
+) {
+    let tasks = task_order(samples);
+    if tasks.is_empty() {
+        return;
+    }
+    let slots: Vec<Mutex<Slot>> = samples
+        .iter()
+        .map(|s| {
+            Mutex::new(Slot {
+                outputs: s.loci.iter().map(|_| None).collect(),
+                remaining: s.loci.len(),
+                error: None,
+            })
+        })
+        .collect();
+    let cursor = AtomicUsize::new(0);
+    let cancelled = AtomicBool::new(false);
+    let workers = workers.clamp(1, tasks.len());
+
+    std::thread::scope(|scope| {
+        for _ in 0..workers {
+            let tx = tx.clone();
+            let (tasks, slots, cursor, cancelled) = (&tasks, &slots, &cursor, &cancelled);
+            scope.spawn(move || {
+                let mut open: Option<(usize, BamSource, Vec<String>)> = None;
+                let mut rec = Record::new();
+                while !cancelled.load(Ordering::Relaxed) {
+                    let t = cursor.fetch_add(1, Ordering::Relaxed);
+                    let Some(&(s, l)) = tasks.get(t) else {
+                        break;
+                    };
+                    let sample = &samples[s];
+                    let failed = slots[s].lock().unwrap().error.is_some();
+                    let output = if failed {
+                        Err(String::new())
+                    } else {
+                        scan_task(&mut open, s, sample, l, realigners, params, &mut rec)
+                    };
+
+                    let mut slot = slots[s].lock().unwrap();
+                    match output {
+                        Ok(out) => slot.outputs[l] = Some(out),
+                        Err(e) => {
+                            slot.error.get_or_insert(e);
+                        }
+                    }
+                    slot.remaining -= 1;
+                    if slot.remaining > 0 {
+                        continue;
+                    }
+                    let outputs = match slot.error.take() {
+                        Some(e) => Err(e),
+                        None => Ok(sample
+                            .loci
+                            .iter()
+                            .zip(slot.outputs.drain(..))
+                            .map(|(locus, out)| (locus.name.clone(), out.unwrap()))
+                            .collect()),
+                    };
+                    drop(slot);
+                    let result = SampleResult { key: sample.key.clone(), outputs };
+                    if tx.send(result).is_err() {
+                        cancelled.store(true, Ordering::Relaxed);
+                    }
+                }
+            });
+        }
+    });
+}
+
+fn scan_task(
+    open: &mut Option<(usize, BamSource, Vec<String>)>,
+    s: usize,
+    sample: &SampleSpec,
+    l: usize,
+    realigners: &[Arc<Realigner>],
+    params: ScanParams,
+    rec: &mut Record,
+) -> Result<LocusOutput, String> {
+    if open.as_ref().map(|(o, _, _)| *o) != Some(s) {
+        *open = None;
+        let reader = BamSource::open(&sample.bam, params.io)
+            .map_err(|e| format!("{}: {e}", sample.bam))?;
+        let names = split::header_names(reader.header());
+        *open = Some((s, reader, names));
+    }
+    let (_, reader, names) = open.as_mut().unwrap();
+    let locus = &sample.loci[l];
+    sample::scan_locus(reader, names, locus, &realigners[sample.realigners[l]], params, rec)
+        .map_err(|e| format!("{}: {e}", locus.name))
+}
+
+/// `(sample, locus)` tasks: sample-major, and within a sample the widest
+/// fetch window (the slowest locus) first.
+fn task_order(samples: &[SampleSpec]) -> Vec<(usize, usize)> {
+    let mut tasks = Vec::new();
+    for (s, sample) in samples.iter().enumerate() {
+        let mut loci: Vec<usize> = (0..sample.loci.len()).collect();
+        loci.sort_by_key(|&l| std::cmp::Reverse(fetch_width(&sample.loci[l])));
+        tasks.extend(loci.into_iter().map(|l| (s, l)));
+    }
+    tasks
+}
+
+fn fetch_width(locus: &LocusSpec) -> i64 {
+    let (start, end) = sample::fetch_window(locus);
+    end - start
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn locus(name: &str, start: i64, end: i64) -> LocusSpec {
+        LocusSpec { name: name.into(), chrom: "chr14".into(), start, end, coverage: None }
+    }
+
+    #[test]
+    fn tasks_are_sample_major_widest_locus_first() {
+        let mut tra = locus("TRA", 0, 1_000);
+        tra.coverage = Some((0, 5_000));
+        let sample = |key: &str| SampleSpec {
+            key: key.into(),
+            bam: String::new(),
+            loci: vec![locus("TRB", 0, 500), tra.clone(), locus("IGH", 0, 2_000)],
+            realigners: vec![0, 1, 2],
+        };
+        let samples = [sample("a"), sample("b")];
+        assert_eq!(
+            task_order(&samples),
+            vec![(0, 1), (0, 2), (0, 0), (1, 1), (1, 2), (1, 0)]
+        );
+    }
+}
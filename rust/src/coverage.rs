@@ -8,8 +8,13 @@
 // where logR is the median log2(focal / baseline) depth ratio.  The same
 // estimator generalises to other V(D)J loci (TRB/TRG/IGH/IGK/IGL).
 
-use rust_htslib::bam::{IndexedReader, Read};
+use std::collections::BTreeSet;
+
+use rust_htslib::bam::record::{Cigar, Record};
 use rust_htslib::errors::Error as HtslibError;
+use rust_htslib::faidx::Reader as FaiReader;
+
+use crate::bamio::{BamSource, IoConfig};
 
 pub struct TcellResult {
     pub baseline_median: f64,
@@ -22,46 +27,227 @@ pub struct TcellResult {
     pub baseline_n: u64,
 }
 
+/// Per-position depth as two parallel, contiguous `int32` buffers, so the
+/// Python layer can hand them to NumPy without copying.
+#[derive(Debug, Default, PartialEq)]
+pub struct DepthTrack {
+    pub positions: Vec<i32>,
+    pub depths: Vec<i32>,
+}
+
+impl DepthTrack {
+    pub fn len(&self) -> usize {
+        self.positions.len()
+    }
+
+    pub fn iter(&self) -> impl Iterator<Item = (i64, u32)> + Clone + '_ {
+        self.positions
+            .iter()
+            .zip(self.depths.iter())
+            .map(|(&p, &d)| (p as i64, d as u32))
+    }
+}
+
+/// Per-position depth over `[start, end)`.  See `DepthAccumulator` for the
+/// filters; every fetched record is filtered and CIGAR-walked once, instead
+/// of re-filtering the whole pileup column at every position.
 pub fn region_coverage(
     bam_path: &str,
     chrom: &str,
     start: i64,
     end: i64,
     min_mapq: u8,
-) -> Result<Vec<(i64, u32)>, HtslibError> {
-    let mut reader = IndexedReader::from_path(bam_path)?;
+    io: IoConfig,
+) -> Result<DepthTrack, HtslibError> {
+    let mut reader = BamSource::open(bam_path, io)?;
     let tid = reader
         .header()
         .tid(chrom.as_bytes())
         .ok_or_else(|| HtslibError::Fetch)?;
-    reader.fetch((tid, start as u64, end as u64))?;
+    let mut acc = DepthAccumulator::new(start, end, min_mapq);
+    accumulate(&mut reader, tid, &mut acc)?;
+    Ok(acc.finish())
+}
 
-    let mut cov = Vec::new();
-    let mut pileup = reader.pileup();
-    pileup.set_max_depth(1_000_000);
+/// Depth restricted to a set of half-open intervals (e.g. a capture-kit BED
+/// for one contig), computed in one pass: the intervals are merged, nearby
+/// ones are grouped into a single fetch so each stretch of the file is
+/// decoded once, and only positions inside an interval are reported
+/// (sorted, each at most once).
+pub fn region_coverage_many(
+    bam_path: &str,
+    chrom: &str,
+    intervals: &[(i64, i64)],
+    min_mapq: u8,
+    io: IoConfig,
+) -> Result<DepthTrack, HtslibError> {
+    let mut reader = BamSource::open(bam_path, io)?;
+    let tid = reader
+        .header()
+        .tid(chrom.as_bytes())
+        .ok_or_else(|| HtslibError::Fetch)?;
 
-    for p in pileup {
-        let pileup = p?;
-        let pos = pileup.pos() as i64;
-        if pos < start || pos >= end {
-            continue;
+    let merged = merge_intervals(intervals);
+    let groups = fetch_groups(&merged);
+    let windows: Vec<(u32, i64, i64)> =
+        groups.iter().map(|g| (tid, g[0].0, g[g.len() - 1].1)).collect();
+    reader.plan(&windows);
+    let mut track = DepthTrack::default();
+    for group in groups {
+        let (start, end) = (group[0].0, group[group.len() - 1].1);
+        let mut acc = DepthAccumulator::new(start, end, min_mapq);
+        accumulate(&mut reader, tid, &mut acc)?;
+        acc.finish_masked(group, &mut track);
+    }
+    Ok(track)
+}
+
+/// Intervals closer than this share one fetch; a gap this small costs less
+/// to decode than a separate index seek.
+const FETCH_GAP: i64 = 65_536;
+
+fn merge_intervals(intervals: &[(i64, i64)]) -> Vec<(i64, i64)> {
+    let mut sorted: Vec<(i64, i64)> = intervals.iter().copied().filter(|(s, e)| s < e).collect();
+    sorted.sort_unstable();
+    let mut merged: Vec<(i64, i64)> = Vec::with_capacity(sorted.len());
+    for (s, e) in sorted {
+        match merged.last_mut() {
+            Some(last) if s <= last.1 => last.1 = last.1.max(e),
+            _ => merged.push((s, e)),
         }
-        let depth = pileup
-            .alignments()
-            .filter(|a| {
-                let r = a.record();
-                !r.is_duplicate()
-                    && !r.is_secondary()
-                    && !r.is_supplementary()
-                    && !r.is_quality_check_failed()
-                    && r.mapq() >= min_mapq
-                    && !a.is_del()
-                    && !a.is_refskip()
-            })
-            .count() as u32;
-        cov.push((pos, depth));
     }
-    Ok(cov)
+    merged
+}
+
+fn fetch_groups(merged: &[(i64, i64)]) -> Vec<&[(i64, i64)]> {
+    let mut groups = Vec::new();
+    let mut first = 0;
+    for i in 1..=merged.len() {
+        if i == merged.len() || merged[i].0 - merged[i - 1].1 > FETCH_GAP {
+            if first < i {
+                groups.push(&merged[first..i]);
+            }
+            first = i;
+        }
+    }
+    groups
+}
+
+fn accumulate(
+    reader: &mut BamSource,
+    tid: u32,
+    acc: &mut DepthAccumulator,
+) -> Result<(), HtslibError> {
+    reader.fetch(tid, acc.start, acc.end)?;
+    let mut rec = Record::new();
+    while let Some(result) = reader.read(&mut rec) {
+        result?;
+        acc.push(&rec);
+    }
+    Ok(())
+}
+
+/// Record-fed depth track over `[start, end)`, for callers that already
+/// stream the records of a region (the fused per-sample scan) and cannot
+/// run a separate pileup.
+///
+/// Reproduces `region_coverage`: a position is reported when the htslib
+/// pileup would visit it — some mapped, primary, non-duplicate, non-QC-fail
+/// read spans it (deletions and ref-skips included) — and its depth counts
+/// the reads that also pass the supplementary / MAPQ filter and place an
+/// aligned base there.  Each record is filtered once and its CIGAR walked
+/// into two difference arrays.
+pub struct DepthAccumulator {
+    start: i64,
+    end: i64,
+    min_mapq: u8,
+    visited: Vec<i32>,
+    depth: Vec<i32>,
+}
+
+impl DepthAccumulator {
+    pub fn new(start: i64, end: i64, min_mapq: u8) -> Self {
+        let n = (end - start).max(0) as usize + 1;
+        Self {
+            start,
+            end,
+            min_mapq,
+            visited: vec![0; n],
+            depth: vec![0; n],
+        }
+    }
+
+    pub fn push(&mut self, rec: &Record) {
+        // htslib's default pileup mask.
+        if rec.is_unmapped() || rec.is_secondary() || rec.is_quality_check_failed() || rec.is_duplicate() {
+            return;
+        }
+        let counted = !rec.is_supplementary() && rec.mapq() >= self.min_mapq;
+        let mut pos = rec.pos();
+        for op in rec.cigar().iter() {
+            match *op {
+                Cigar::Match(n) | Cigar::Equal(n) | Cigar::Diff(n) => {
+                    let n = n as i64;
+                    add_span(&mut self.visited, self.start, self.end, pos, pos + n);
+                    if counted {
+                        add_span(&mut self.depth, self.start, self.end, pos, pos + n);
+                    }
+                    pos += n;
+                }
+                Cigar::Del(n) | Cigar::RefSkip(n) => {
+                    let n = n as i64;
+                    add_span(&mut self.visited, self.start, self.end, pos, pos + n);
+                    pos += n;
+                }
+                Cigar::Ins(_) | Cigar::SoftClip(_) | Cigar::HardClip(_) | Cigar::Pad(_) => {}
+            }
+        }
+    }
+
+    pub fn finish(self) -> DepthTrack {
+        let mut track = DepthTrack::default();
+        let span = (self.start, self.end);
+        self.finish_masked(&[span], &mut track);
+        track
+    }
+
+    /// Append the positions inside `mask` (sorted, disjoint, within the
+    /// accumulator window) to `track`.
+    pub fn finish_masked(self, mask: &[(i64, i64)], track: &mut DepthTrack) {
+        let (mut visited, mut depth) = (0_i32, 0_i32);
+        let mut cursor = self.start;
+        for &(s, e) in mask {
+            let (s, e) = (s.max(self.start), e.min(self.end));
+            if s >= e {
+                continue;
+            }
+            // Roll the running sums forward to the interval start.
+            while cursor < s {
+                let i = (cursor - self.start) as usize;
+                visited += self.visited[i];
+                depth += self.depth[i];
+                cursor += 1;
+            }
+            while cursor < e {
+                let i = (cursor - self.start) as usize;
+                visited += self.visited[i];
+                depth += self.depth[i];
+                if visited > 0 {
+                    track.positions.push(cursor as i32);
+                    track.depths.push(depth);
+                }
+                cursor += 1;
+            }
+        }
+    }
+}
+
+fn add_span(diff: &mut [i32], start: i64, end: i64, from: i64, to: i64) {
+    let (from, to) = (from.max(start), to.min(end));
+    if from < to {
+        diff[(from - start) as usize] += 1;
+        diff[(to - start) as usize] -= 1;
+    }
 }
 
 pub fn tcell_fraction(
@@ -73,26 +259,32 @@ pub fn tcell_fraction(
     min_mapq: u8,
     min_cov: u32,
     target_mask: &[(i64, i64)],
+    io: IoConfig,
 ) -> Result<TcellResult, HtslibError> {
     let lo = left_baseline.0.min(focal.0);
     let hi = right_baseline.1.max(focal.1);
-    let cov = region_coverage(bam_path, chrom, lo, hi, min_mapq)?;
+    let track = region_coverage(bam_path, chrom, lo, hi, min_mapq, io)?;
     Ok(fraction_from_positions(
-        &cov, focal, left_baseline, right_baseline, min_cov, target_mask,
+        track.iter(), focal, left_baseline, right_baseline, min_cov, target_mask,
     ))
 }
 
 /// Pure compute on an already-extracted coverage track — the form
 /// TcellExTRECT's R `runTcellExTRECT` takes.  Useful for cross-validating
 /// against their reference `cov_example` fixture without touching a BAM.
-pub fn fraction_from_positions(
-    cov: &[(i64, u32)],
+/// `cov` yields `(position, depth)` and is walked twice, so callers can
+/// stream it straight from their own buffers.
+pub fn fraction_from_positions<I>(
+    cov: I,
     focal: (i64, i64),
     left_baseline: (i64, i64),
     right_baseline: (i64, i64),
     min_cov: u32,
     target_mask: &[(i64, i64)],
-) -> TcellResult {
+) -> TcellResult
+where
+    I: Iterator<Item = (i64, u32)> + Clone,
+{
     let in_range = |pos: i64, (s, e): (i64, i64)| pos >= s && pos < e;
     // `target_mask` = capture-kit exon intervals whose positions should be
     // EXCLUDED from the coverage median.  The TCRA V-J focal window is
@@ -116,18 +308,17 @@ pub fn fraction_from_positions(
     };
 
     let mut baseline: Vec<f64> = cov
-        .iter()
+        .clone()
         .filter(|(p, d)| {
             *d >= min_cov
                 && !is_masked(*p)
                 && (in_range(*p, left_baseline) || in_range(*p, right_baseline))
         })
-        .map(|(_, d)| *d as f64)
+        .map(|(_, d)| d as f64)
         .collect();
     let mut focal_vals: Vec<f64> = cov
-        .iter()
         .filter(|(p, d)| *d >= min_cov && !is_masked(*p) && in_range(*p, focal))
-        .map(|(_, d)| *d as f64)
+        .map(|(_, d)| d as f64)
         .collect();
 
     if baseline.is_empty() || focal_vals.is_empty() {
@@ -182,6 +373,606 @@ pub fn fraction_from_positions(
     }
 }
 
+// ---- Upstream exon-smoothed estimator -------------------------------------
+//
+// Native port of `tcell._estimate_upstream_from_coverage_df`, the
+// McGranahanLab/TcellExTRECT exon workflow.  Each exon is smoothed with a
+// running median and dropped if its smoothed depth is too low.  Positions
+// get a log2 ratio against the baseline median, optionally GC corrected.
+// A tricube local-linear (LOESS) fit over the locus then gives the focal
+// dip, its confidence band and `qc_fit`.  The arithmetic follows the Python
+// step for step; only the algorithms change:
+//   - the running median keeps its window as two ordered halves, so a step
+//     costs O(log k) rather than a sort of the whole window;
+//   - window GC comes from prefix counts over the locus sequence;
+//   - each LOESS evaluation finds its k nearest positions by binary search
+//     and visits only the points that can carry weight, instead of
+//     partitioning the distances to every point.
+// Results agree with the Python path to within floating-point summation
+// order: 1e-9 relative on every float field for `cov_example`.
+
+/// Inputs of `upstream_fraction` besides the coverage track.  Intervals are
+/// inclusive `(start, end)`, as in the Python `LocusSegments`.
+pub struct UpstreamParams<'a> {
+    pub chrom: &'a str,
+    pub full: (i64, i64),
+    pub focal: (i64, i64),
+    pub left_baseline: (i64, i64),
+    pub right_baseline: (i64, i64),
+    pub exons: &'a [(i64, i64)],
+    pub min_cov: f64,
+    pub median_k: usize,
+    pub median_thresh: f64,
+    /// Indexed FASTA enabling GC correction.  An unreadable file or contig
+    /// leaves the ratio uncorrected, as in the Python path.
+    pub reference_fasta: Option<&'a str>,
+}
+
+pub struct UpstreamResult {
+    pub tcell: TcellResult,
+    pub qc_fit: f64,
+    pub gc_corrected: bool,
+    pub exons_removed: usize,
+    /// Set when no estimate could be made (`no_usable_exons`, ...).
+    pub failure_reason: Option<&'static str>,
+}
+
+/// More dropped exons than this and the locus is not trusted at all.
+const MAX_REMOVED_EXONS: usize = 30;
+/// Spacing of the LOESS evaluation grid, in bases.
+const FIT_STEP: i64 = 100;
+/// Width of the reference GC windows, in bases.
+const GC_WINDOW: usize = 1000;
+
+struct ExonRow {
+    pos: i64,
+    reads: f64,
+    exon: usize,
+}
+
+/// Exon-smoothed TcellExTRECT estimate from a coverage track with strictly
+/// increasing `positions`.
+pub fn upstream_fraction(positions: &[i64], depths: &[f64], p: &UpstreamParams) -> UpstreamResult {
+    let inside = |pos: i64, (s, e): (i64, i64)| pos >= s && pos <= e;
+    let in_baseline = |pos: i64| inside(pos, p.left_baseline) || inside(pos, p.right_baseline);
+    let mut out = UpstreamResult {
+        tcell: TcellResult {
+            baseline_median: f64::NAN,
+            focal_median: f64::NAN,
+            log2_ratio: f64::NAN,
+            tcell_fraction: f64::NAN,
+            tcell_fraction_lwr: f64::NAN,
+            tcell_fraction_upr: f64::NAN,
+            focal_n: 0,
+            baseline_n: 0,
+        },
+        qc_fit: f64::NAN,
+        gc_corrected: false,
+        exons_removed: 0,
+        failure_reason: None,
+    };
+
+    let (rows, removed) =
+        select_exon_coverage(positions, depths, p.exons, p.median_k, p.median_thresh);
+    out.exons_removed = removed;
+    if rows.is_empty() || removed > MAX_REMOVED_EXONS {
+        out.failure_reason = Some("no_usable_exons");
+        return out;
+    }
+    let rows: Vec<ExonRow> = rows.into_iter().filter(|r| r.reads >= p.min_cov).collect();
+    if rows.is_empty() {
+        out.failure_reason = Some("no_positions_after_min_cov");
+        return out;
+    }
+
+    let mut baseline: Vec<f64> = rows.iter().filter(|r| in_baseline(r.pos)).map(|r| r.reads).collect();
+    let mut focal: Vec<f64> = rows.iter().filter(|r| inside(r.pos, p.focal)).map(|r| r.reads).collect();
+    out.tcell.focal_n = focal.len() as u64;
+    if baseline.is_empty() {
+        out.failure_reason = Some("no_baseline_positions");
+        return out;
+    }
+    out.tcell.baseline_n = baseline.len() as u64;
+    let baseline_median = median(&mut baseline);
+    out.tcell.baseline_median = baseline_median;
+    out.tcell.focal_median = median(&mut focal);
+
+    let (rows, ratio): (Vec<ExonRow>, Vec<f64>) = rows
+        .into_iter()
+        .map(|r| {
+            let ratio = (r.reads / baseline_median).log2();
+            (r, ratio)
+        })
+        .filter(|(_, ratio)| ratio.is_finite())
+        .unzip();
+    if rows.is_empty() {
+        out.failure_reason = Some("no_finite_logr");
+        return out;
+    }
+    let pos: Vec<f64> = rows.iter().map(|r| r.pos as f64).collect();
+    let ratio = match p.reference_fasta.and_then(|fa| gc_corrected_ratio(fa, p, &rows, &pos, &ratio)) {
+        Some(corrected) => {
+            out.gc_corrected = true;
+            corrected
+        }
+        None => ratio,
+    };
+
+    let baseline_logr: Vec<f64> = rows
+        .iter()
+        .zip(ratio.iter())
+        .filter(|(r, _)| in_baseline(r.pos))
+        .map(|(_, &v)| v)
+        .collect();
+    let baseline_adjust = mean(&baseline_logr);
+    let baseline_ci = if baseline_logr.len() > 1 {
+        let n = baseline_logr.len() as f64;
+        let var = baseline_logr.iter().map(|v| (v - baseline_adjust).powi(2)).sum::<f64>() / (n - 1.0);
+        1.96 * var.sqrt() / n.sqrt()
+    } else {
+        0.0
+    };
+
+    let grid_full = fit_grid(p.full);
+    let smooth = loess(&pos, &ratio, &grid_full, 0.2, 100);
+    out.qc_fit = qc_fit(&smooth.est);
+
+    // Grid points strictly inside the focal window, else the ones nearest
+    // its midpoint.
+    let mut focal_fit: Vec<usize> = (0..grid_full.len())
+        .filter(|&i| grid_full[i] > p.focal.0 as f64 && grid_full[i] < p.focal.1 as f64)
+        .collect();
+    if focal_fit.is_empty() {
+        let mid = (p.focal.0 as f64 + p.focal.1 as f64) / 2.0;
+        let nearest = grid_full.iter().map(|g| (g - mid).abs()).fold(f64::INFINITY, f64::min);
+        focal_fit = (0..grid_full.len()).filter(|&i| (grid_full[i] - mid).abs() == nearest).collect();
+    }
+    let smooth_adjust = nanmean(focal_fit.iter().map(|&i| smooth.est[i]));
+    let smooth_ci = nanmean(focal_fit.iter().map(|&i| smooth.upper[i])) - smooth_adjust;
+    let (adjust, norm_ci) = if smooth_adjust > baseline_adjust {
+        (smooth_adjust, smooth_ci)
+    } else {
+        (baseline_adjust, baseline_ci)
+    };
+
+    let adjusted: Vec<f64> = ratio.iter().map(|v| v - adjust).collect();
+    let fit = loess(&pos, &adjusted, &fit_grid(p.focal), 0.2, 100);
+    let log2_ratio = nanmean(fit.est.iter().copied());
+    let log2_ratio_min = nanmean(fit.lower.iter().copied()) - norm_ci;
+    let log2_ratio_max = nanmean(fit.upper.iter().copied()) + norm_ci;
+    // `f64::clamp` keeps NaN and pins ±inf, like the Python `_clamp01`.
+    let fraction = |lr: f64| (1.0 - 2f64.powf(lr)).clamp(0.0, 1.0);
+    out.tcell.log2_ratio = log2_ratio;
+    out.tcell.tcell_fraction = fraction(log2_ratio);
+    out.tcell.tcell_fraction_upr = fraction(log2_ratio_min);
+    out.tcell.tcell_fraction_lwr = fraction(log2_ratio_max);
+    out
+}
+
+/// Running-median smoothed depth of every exon, dropping exons with no
+/// positions or a smoothed median below `median_thresh`.  Rows are in exon
+/// order; a position shared by two exons stays with the first.  Returns
+/// the rows and the number of exons dropped.
+fn select_exon_coverage(
+    positions: &[i64],
+    depths: &[f64],
+    exons: &[(i64, i64)],
+    median_k: usize,
+    median_thresh: f64,
+) -> (Vec<ExonRow>, usize) {
+    let mut rows = Vec::new();
+    let mut removed = 0;
+    let mut taken = vec![false; positions.len()];
+    for (exon, &(start, end)) in exons.iter().enumerate() {
+        let lo = positions.partition_point(|&p| p < start);
+        let hi = positions.partition_point(|&p| p <= end);
+        if lo >= hi {
+            removed += 1;
+            continue;
+        }
+        let smoothed = running_median(&depths[lo..hi], median_k);
+        let exon_median = median(&mut smoothed.clone());
+        if !exon_median.is_finite() || exon_median < median_thresh {
+            removed += 1;
+            continue;
+        }
+        for (i, reads) in (lo..hi).zip(smoothed) {
+            if !taken[i] {
+                taken[i] = true;
+                rows.push(ExonRow { pos: positions[i], reads, exon });
+            }
+        }
+    }
+    (rows, removed)
+}
+
+/// Running median of width `2k + 1`, narrowed to the largest odd width that
+/// fits, with the window padded past either end by repeating the end value.
+fn running_median(values: &[f64], k: usize) -> Vec<f64> {
+    let n = values.len();
+    let mut width = 2 * k + 1;
+    if width > n {
+        width = if n % 2 == 0 { n.saturating_sub(1) } else { n };
+    }
+    if width <= 1 {
+        return values.to_vec();
+    }
+    let half = width / 2;
+    // Element `i` of the end-padded sequence; output `i` is the median of
+    // padded elements `i..i + width`.
+    let padded = |i: usize| values[i.saturating_sub(half).min(n - 1)];
+
+    let mut window = MedianWindow::default();
+    for i in 0..width {
+        window.insert(Ranked(padded(i), i));
+    }
+    let mut out = Vec::with_capacity(n);
+    out.push(window.median());
+    for i in 1..n {
+        window.remove(Ranked(padded(i - 1), i - 1));
+        window.insert(Ranked(padded(i + width - 1), i + width - 1));
+        out.push(window.median());
+    }
+    out
+}
+
+/// A value tagged with its padded index, so equal depths stay distinct.
+#[derive(Clone, Copy)]
+struct Ranked(f64, usize);
+
+impl Ord for Ranked {
+    fn cmp(&self, other: &Self) -> std::cmp::Ordering {
+        self.0.total_cmp(&other.0).then(self.1.cmp(&other.1))
+    }
+}
+
+impl PartialOrd for Ranked {
+    fn partial_cmp(&self, other: &Self) -> Option<std::cmp::Ordering> {
+        Some(self.cmp(other))
+    }
+}
+
+impl PartialEq for Ranked {
+    fn eq(&self, other: &Self) -> bool {
+        self.cmp(other).is_eq()
+    }
+}
+
+impl Eq for Ranked {}
+
+/// An odd-sized window split into a lower half (holding the middle
+/// element) and an upper half; the median is the top of the lower half.
+#[derive(Default)]
+struct MedianWindow {
+    low: BTreeSet<Ranked>,
+    high: BTreeSet<Ranked>,
+}
+
+impl MedianWindow {
+    fn insert(&mut self, item: Ranked) {
+        match self.low.last() {
+            Some(top) if item > *top => self.high.insert(item),
+            _ => self.low.insert(item),
+        };
+        self.rebalance();
+    }
+
+    fn remove(&mut self, item: Ranked) {
+        if !self.low.remove(&item) {
+            self.high.remove(&item);
+        }
+        self.rebalance();
+    }
+
+    fn rebalance(&mut self) {
+        while self.low.len() > self.high.len() + 1 {
+            let top = self.low.pop_last().unwrap();
+            self.high.insert(top);
+        }
+        while self.high.len() > self.low.len() {
+            let bottom = self.high.pop_first().unwrap();
+            self.low.insert(bottom);
+        }
+    }
+
+    fn median(&self) -> f64 {
+        self.low.last().map_or(f64::NAN, |r| r.0)
+    }
+}
+
+struct LoessFit {
+    est: Vec<f64>,
+    lower: Vec<f64>,
+    upper: Vec<f64>,
+}
+
+/// Tricube-weighted local-linear fit of `y` on `x` at each `grid` point,
+/// over the `max(frac * n, min_points)` nearest points, with a normal 95%
+/// band from the weighted residual variance.
+fn loess(x: &[f64], y: &[f64], grid: &[f64], frac: f64, min_points: usize) -> LoessFit {
+    let n = x.len();
+    // NumPy carries a non-finite response into every weighted sum (even at
+    // weight zero), so every estimate is NaN.
+    if n == 0 || y.iter().any(|v| !v.is_finite()) {
+        let nan = vec![f64::NAN; grid.len()];
+        return LoessFit { est: nan.clone(), lower: nan.clone(), upper: nan };
+    }
+    let k = n.min(((frac * n as f64).ceil() as usize).max(min_points));
+    let mut order: Vec<usize> = (0..n).collect();
+    order.sort_by(|&a, &b| x[a].total_cmp(&x[b]));
+    let xs: Vec<f64> = order.iter().map(|&i| x[i]).collect();
+    let ys: Vec<f64> = order.iter().map(|&i| y[i]).collect();
+
+    let mut fit = LoessFit {
+        est: Vec::with_capacity(grid.len()),
+        lower: Vec::with_capacity(grid.len()),
+        upper: Vec::with_capacity(grid.len()),
+    };
+    for &g in grid {
+        let (lo, hi, h) = neighbourhood(&xs, k, g);
+        let weight = |i: usize| {
+            let u = (xs[i] - g).abs() / h;
+            if u < 1.0 {
+                (1.0 - u.powi(3)).powi(3)
+            } else {
+                0.0
+            }
+        };
+        let (mut s0, mut s1, mut s2, mut t0, mut t1, mut sw2) = (0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
+        for i in lo..hi {
+            let (w, z) = (weight(i), xs[i] - g);
+            s0 += w;
+            s1 += w * z;
+            s2 += w * z * z;
+            t0 += w * ys[i];
+            t1 += w * z * ys[i];
+            sw2 += w * w;
+        }
+        if s0 <= 0.0 {
+            fit.est.push(f64::NAN);
+            fit.lower.push(f64::NAN);
+            fit.upper.push(f64::NAN);
+            continue;
+        }
+        let det = s0 * s2 - s1 * s1;
+        let (fit0, fit1) = if det.abs() < 1e-12 {
+            (t0 / s0, 0.0)
+        } else {
+            ((t0 * s2 - t1 * s1) / det, (t1 * s0 - t0 * s1) / det)
+        };
+        let rss: f64 = (lo..hi)
+            .map(|i| weight(i) * (ys[i] - (fit0 + fit1 * (xs[i] - g))).powi(2))
+            .sum();
+        let resid_var = rss / s0;
+        let eff_n = s0 * s0 / sw2.max(1e-12);
+        let se = (resid_var.max(0.0) / (eff_n - 2.0).max(1.0)).sqrt();
+        fit.est.push(fit0);
+        fit.lower.push(fit0 - 1.96 * se);
+        fit.upper.push(fit0 + 1.96 * se);
+    }
+    fit
+}
+
+/// Bandwidth around `g` — the distance to the k-th nearest point of the
+/// sorted `xs`, or to the nearest point not at `g` if that is zero — and
+/// the index range `[lo, hi)` of the points closer than it.
+fn neighbourhood(xs: &[f64], k: usize, g: f64) -> (usize, usize, f64) {
+    let n = xs.len();
+    // The k nearest points are contiguous.  Find the first window start
+    // whose next point to the right is no closer than its leftmost point.
+    let (mut a, mut b) = (0, n - k);
+    while a < b {
+        let m = (a + b) / 2;
+        if xs[m + k] - g < g - xs[m] {
+            a = m + 1;
+        } else {
+            b = m;
+        }
+    }
+    let (mut lo, mut hi) = (a, a + k);
+    let mut h = (g - xs[lo]).abs().max((xs[hi - 1] - g).abs());
+    if h <= 0.0 {
+        let below = xs.partition_point(|&v| v < g);
+        let above = xs.partition_point(|&v| v <= g);
+        let mut nearest = f64::INFINITY;
+        if below > 0 {
+            nearest = nearest.min(g - xs[below - 1]);
+        }
+        if above < n {
+            nearest = nearest.min(xs[above] - g);
+        }
+        h = if nearest.is_finite() { nearest } else { 1.0 };
+    }
+    while lo > 0 && (xs[lo - 1] - g).abs() / h < 1.0 {
+        lo -= 1;
+    }
+    while hi < n && (xs[hi] - g).abs() / h < 1.0 {
+        hi += 1;
+    }
+    (lo, hi, h)
+}
+
+/// `np.arange(start, end + 1, FIT_STEP)` as floats.
+fn fit_grid((start, end): (i64, i64)) -> Vec<f64> {
+    (0..)
+        .map(|i| start + i * FIT_STEP)
+        .take_while(|&v| v <= end)
+        .map(|v| v as f64)
+        .collect()
+}
+
+/// Mean of the local extrema of a fitted curve, each relative to the
+/// largest in magnitude; NaN for fewer than three finite points.
+fn qc_fit(smoothed: &[f64]) -> f64 {
+    let s: Vec<f64> = smoothed.iter().copied().filter(|v| v.is_finite()).collect();
+    if s.len() < 3 {
+        return f64::NAN;
+    }
+    let (mut minima, mut maxima) = (Vec::new(), Vec::new());
+    for w in s.windows(3) {
+        if w[1] >= w[0] && w[1] >= w[2] {
+            maxima.push(w[1]);
+        }
+        if w[1] <= w[0] && w[1] <= w[2] {
+            minima.push(w[1]);
+        }
+    }
+    minima.extend(maxima);
+    let extrema = minima;
+    if extrema.is_empty() {
+        return 1.0;
+    }
+    let denom = extrema.iter().fold(0.0_f64, |m, v| m.max(v.abs()));
+    if denom <= 0.0 {
+        return 1.0;
+    }
+    extrema.iter().map(|v| (v / denom).abs()).sum::<f64>() / extrema.len() as f64
+}
+
+/// The log ratio after regressing out exon GC and smoothed regional GC
+/// (linear and quadratic terms); rows with no finite GC come back NaN.
+/// `None` when the reference cannot be read or too few rows have GC.
+fn gc_corrected_ratio(
+    reference_fasta: &str,
+    p: &UpstreamParams,
+    rows: &[ExonRow],
+    pos: &[f64],
+    ratio: &[f64],
+) -> Option<Vec<f64>> {
+    let reader = FaiReader::from_path(reference_fasta).ok()?;
+    // Inclusive bounds, as `fetch_seq` takes them.
+    let fetch = |start: i64, end: i64| reader.fetch_seq_string(p.chrom, start.max(0) as usize, end as usize).ok();
+    let exon_gc = p
+        .exons
+        .iter()
+        .map(|&(s, e)| fetch(s, e).map(|seq| gc_fraction(seq.as_bytes())))
+        .collect::<Option<Vec<f64>>>()?;
+    let full_seq = fetch(p.full.0, p.full.1)?;
+
+    let (grid_pos, grid_gc): (Vec<f64>, Vec<f64>) = window_gc(full_seq.as_bytes(), GC_WINDOW)
+        .into_iter()
+        .map(|(offset, gc)| ((p.full.0 + offset as i64) as f64, gc))
+        .filter(|(_, gc)| gc.is_finite())
+        .unzip();
+    if grid_pos.is_empty() {
+        return None;
+    }
+    let smooth_gc = loess(&grid_pos, &grid_gc, pos, 0.15, 25).est;
+
+    let usable: Vec<usize> = (0..rows.len())
+        .filter(|&i| exon_gc[rows[i].exon].is_finite() && smooth_gc[i].is_finite())
+        .collect();
+    if usable.len() < 5 {
+        return None;
+    }
+    let column = |f: &dyn Fn(usize) -> f64| usable.iter().map(|&i| f(i)).collect::<Vec<f64>>();
+    let design = vec![
+        column(&|_| 1.0),
+        column(&|i| exon_gc[rows[i].exon]),
+        column(&|i| smooth_gc[i]),
+        column(&|i| exon_gc[rows[i].exon].powi(2)),
+        column(&|i| smooth_gc[i].powi(2)),
+    ];
+    let residuals = lstsq_residuals(design, &column(&|i| ratio[i]));
+    let mut corrected = vec![f64::NAN; rows.len()];
+    for (&i, r) in usable.iter().zip(residuals) {
+        corrected[i] = r;
+    }
+    Some(corrected)
+}
+
+/// GC fraction of the unambiguous bases of `seq`, NaN if there are none.
+fn gc_fraction(seq: &[u8]) -> f64 {
+    let (mut valid, mut gc) = (0_usize, 0_usize);
+    for b in seq {
+        match b.to_ascii_uppercase() {
+            b'G' | b'C' => {
+                valid += 1;
+                gc += 1;
+            }
+            b'A' | b'T' => valid += 1,
+            _ => {}
+        }
+    }
+    if valid == 0 {
+        f64::NAN
+    } else {
+        gc as f64 / valid as f64
+    }
+}
+
+/// `(offset, gc_fraction)` of the windows `[s, s + width)` of `seq` for
+/// every `s` a multiple of `width` up to `len - width` (a single, shorter
+/// window when `seq` is shorter than `width`), from prefix counts.
+fn window_gc(seq: &[u8], width: usize) -> Vec<(usize, f64)> {
+    let mut valid = Vec::with_capacity(seq.len() + 1);
+    let mut gc = Vec::with_capacity(seq.len() + 1);
+    let (mut v, mut g) = (0_u32, 0_u32);
+    valid.push(0);
+    gc.push(0);
+    for b in seq {
+        match b.to_ascii_uppercase() {
+            b'G' | b'C' => {
+                v += 1;
+                g += 1;
+            }
+            b'A' | b'T' => v += 1,
+            _ => {}
+        }
+        valid.push(v);
+        gc.push(g);
+    }
+    (0..=seq.len().saturating_sub(width))
+        .step_by(width)
+        .map(|s| {
+            let e = (s + width).min(seq.len());
+            let n = valid[e] - valid[s];
+            let frac = if n == 0 { f64::NAN } else { (gc[e] - gc[s]) as f64 / n as f64 };
+            (s, frac)
+        })
+        .collect()
+}
+
+/// Residuals of the least-squares fit of `y` on `columns`.  Modified
+/// Gram-Schmidt with re-orthogonalisation; a column numerically dependent
+/// on earlier ones is skipped, which leaves the projection, and so the
+/// residuals, as `np.linalg.lstsq` finds them.
+fn lstsq_residuals(columns: Vec<Vec<f64>>, y: &[f64]) -> Vec<f64> {
+    let dot = |a: &[f64], b: &[f64]| a.iter().zip(b).map(|(x, y)| x * y).sum::<f64>();
+    let project_out = |basis: &[Vec<f64>], v: &mut Vec<f64>| {
+        for _ in 0..2 {
+            for q in basis {
+                let d = dot(q, v);
+                v.iter_mut().zip(q).for_each(|(x, qi)| *x -= d * qi);
+            }
+        }
+    };
+    let mut basis: Vec<Vec<f64>> = Vec::with_capacity(columns.len());
+    for mut c in columns {
+        let norm0 = dot(&c, &c).sqrt();
+        project_out(&basis, &mut c);
+        let norm = dot(&c, &c).sqrt();
+        if norm == 0.0 || norm <= 1e-10 * norm0 {
+            continue;
+        }
+        c.iter_mut().for_each(|x| *x /= norm);
+        basis.push(c);
+    }
+    let mut r = y.to_vec();
+    project_out(&basis, &mut r);
+    r
+}
+
+fn mean(values: &[f64]) -> f64 {
+    values.iter().sum::<f64>() / values.len() as f64
+}
+
+/// Mean ignoring NaN; NaN if nothing is left.
+fn nanmean(values: impl Iterator<Item = f64>) -> f64 {
+    let (sum, n) = values.filter(|v| !v.is_nan()).fold((0.0, 0_usize), |(s, n), v| (s + v, n + 1));
+    sum / n as f64
+}
+
 fn median(values: &mut [f64]) -> f64 {
     values.sort_by(|a, b| a.partial_cmp(b).unwrap_or(std::cmp::Ordering::Equal));
     let n = values.len();
@@ -218,6 +1009,171 @@ mod tests {
         assert_eq!(median(&mut [1.0, 2.0, 3.0, 4.0]), 2.5);
     }
 
+    fn record(pos: i64, cigar: Vec<Cigar>, flags: u16, mapq: u8) -> Record {
+        use rust_htslib::bam::record::CigarString;
+        let qlen: u32 = cigar
+            .iter()
+            .map(|c| match *c {
+                Cigar::Match(n) | Cigar::Ins(n) | Cigar::SoftClip(n) | Cigar::Equal(n) | Cigar::Diff(n) => n,
+                _ => 0,
+            })
+            .sum();
+        let mut rec = Record::new();
+        let seq = vec![b'A'; qlen as usize];
+        rec.set(b"r", Some(&CigarString(cigar)), &seq, &vec![30; seq.len()]);
+        rec.set_pos(pos);
+        rec.set_flags(flags);
+        rec.set_mapq(mapq);
+        rec
+    }
+
+    #[test]
+    fn depth_accumulator_matches_pileup_semantics() {
+        let mut acc = DepthAccumulator::new(100, 120, 1);
+        // 5M2D5M from 98: bases 98..103 and 105..110, deletion 103..105.
+        acc.push(&record(98, vec![Cigar::Match(5), Cigar::Del(2), Cigar::Match(5)], 0, 60));
+        // Soft clip does not consume reference; MAPQ 0 read is visited but
+        // not counted.
+        acc.push(&record(104, vec![Cigar::SoftClip(3), Cigar::Match(4)], 0, 0));
+        // Duplicates are invisible to the pileup entirely.
+        acc.push(&record(115, vec![Cigar::Match(10)], 0x400, 60));
+        // Supplementary: visited, not counted.  Ends past the window.
+        acc.push(&record(118, vec![Cigar::Match(10)], 0x800, 60));
+        let cov: Vec<(i64, u32)> = acc.finish().iter().collect();
+        let expect: Vec<(i64, u32)> = vec![
+            (100, 1), (101, 1), (102, 1), (103, 0), (104, 0),
+            (105, 1), (106, 1), (107, 1), (108, 1), (109, 1),
+            (118, 0), (119, 0),
+        ];
+        assert_eq!(cov, expect);
+    }
+
+    #[test]
+    fn masked_depth_reports_only_interval_positions() {
+        let mut acc = DepthAccumulator::new(0, 50, 0);
+        acc.push(&record(0, vec![Cigar::Match(50)], 0, 60));
+        acc.push(&record(20, vec![Cigar::Match(10)], 0, 60));
+        let mut track = DepthTrack::default();
+        acc.finish_masked(&[(5, 8), (25, 32)], &mut track);
+        assert_eq!(track.positions, vec![5, 6, 7, 25, 26, 27, 28, 29, 30, 31]);
+        assert_eq!(track.depths, vec![1, 1, 1, 2, 2, 2, 2, 2, 1, 1]);
+    }
+
+    #[test]
+    fn intervals_are_merged_and_grouped_for_fetch() {
+        let merged = merge_intervals(&[(30, 40), (0, 10), (5, 12), (12, 15), (200_000, 200_010), (50, 50)]);
+        assert_eq!(merged, vec![(0, 15), (30, 40), (200_000, 200_010)]);
+        let groups = fetch_groups(&merged);
+        assert_eq!(groups, vec![&merged[..2], &merged[2..]]);
+        assert!(fetch_groups(&[]).is_empty());
+    }
+
+    /// The sliding median must equal sorting every end-padded window, for
+    /// inputs shorter and longer than the window.
+    #[test]
+    fn running_median_matches_sorted_windows() {
+        let mut state = 0x9E37_79B9_7F4A_7C15_u64;
+        let values: Vec<f64> = (0..300)
+            .map(|_| {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                (state % 40) as f64
+            })
+            .collect();
+        for n in [0, 1, 2, 5, 8, 300] {
+            for k in [0, 1, 3, 50] {
+                let v = &values[..n];
+                let mut width = 2 * k + 1;
+                if width > n {
+                    width = if n % 2 == 0 { n.saturating_sub(1) } else { n };
+                }
+                let half = width / 2;
+                let naive: Vec<f64> = (0..n)
+                    .map(|i| {
+                        if width <= 1 {
+                            return v[i];
+                        }
+                        let mut w: Vec<f64> =
+                            (i..i + width).map(|j| v[j.saturating_sub(half).min(n - 1)]).collect();
+                        median(&mut w)
+                    })
+                    .collect();
+                assert_eq!(running_median(v, k), naive, "n={n} k={k}");
+            }
+        }
+    }
+
+    /// LOESS over the windowed neighbourhood must match weighting every
+    /// point by its distance, ties and duplicate x included.
+    #[test]
+    fn loess_matches_full_weighting() {
+        let x: Vec<f64> = [0, 3, 3, 3, 7, 10, 11, 15, 20, 20, 28, 40, 41, 55, 60]
+            .iter()
+            .map(|&v| v as f64)
+            .collect();
+        let y: Vec<f64> = x.iter().map(|v| (v * 0.37).sin() + v * 0.01).collect();
+        let grid: Vec<f64> = (-5..70).map(|g| g as f64).collect();
+        for min_points in [1, 4, 15] {
+            let fit = loess(&x, &y, &grid, 0.2, min_points);
+            let k = x.len().min(((0.2 * x.len() as f64).ceil() as usize).max(min_points));
+            for (i, &g) in grid.iter().enumerate() {
+                let dist: Vec<f64> = x.iter().map(|v| (v - g).abs()).collect();
+                let mut h = {
+                    let mut d = dist.clone();
+                    d.sort_by(f64::total_cmp);
+                    d[k - 1]
+                };
+                if h <= 0.0 {
+                    h = dist.iter().copied().filter(|&d| d > 0.0).fold(f64::INFINITY, f64::min);
+                }
+                let w: Vec<f64> = dist
+                    .iter()
+                    .map(|d| if d / h < 1.0 { (1.0 - (d / h).powi(3)).powi(3) } else { 0.0 })
+                    .collect();
+                let (s0, s1, s2, t0, t1) = x.iter().zip(&y).zip(&w).fold(
+                    (0.0, 0.0, 0.0, 0.0, 0.0),
+                    |(s0, s1, s2, t0, t1), ((xi, yi), wi)| {
+                        let z = xi - g;
+                        (s0 + wi, s1 + wi * z, s2 + wi * z * z, t0 + wi * yi, t1 + wi * z * yi)
+                    },
+                );
+                let det = s0 * s2 - s1 * s1;
+                let expect = if det.abs() < 1e-12 { t0 / s0 } else { (t0 * s2 - t1 * s1) / det };
+                if s0 <= 0.0 {
+                    // Every point sits on the bandwidth edge.
+                    assert!(fit.est[i].is_nan(), "g={g}");
+                    continue;
+                }
+                assert!((fit.est[i] - expect).abs() < 1e-9, "g={g} {} vs {expect}", fit.est[i]);
+                assert!(fit.lower[i] <= fit.est[i] && fit.est[i] <= fit.upper[i]);
+            }
+        }
+        let with_nan = loess(&x, &[f64::NAN; 15], &grid, 0.2, 4);
+        assert!(with_nan.est.iter().all(|v| v.is_nan()));
+    }
+
+    #[test]
+    fn gc_windows_and_lstsq_residuals() {
+        let gc = window_gc(b"GGCCNNNNAAtt", 4);
+        assert_eq!(gc[0], (0, 1.0));
+        assert!(gc[1].1.is_nan());
+        assert_eq!(gc[2], (8, 0.0));
+        assert_eq!(window_gc(b"ACG", 4), vec![(0, 2.0 / 3.0)]);
+        assert!(gc_fraction(b"NNN").is_nan());
+
+        // y = 2 + 3x exactly, with a duplicated column: zero residuals.
+        let x = vec![0.1, 0.4, 0.5, 0.9, 1.3];
+        let y: Vec<f64> = x.iter().map(|v| 2.0 + 3.0 * v).collect();
+        let r = lstsq_residuals(vec![vec![1.0; 5], x.clone(), x.clone()], &y);
+        assert!(r.iter().all(|v| v.abs() < 1e-12));
+        // Residuals of a noisy fit are orthogonal to every column.
+        let noisy: Vec<f64> = y.iter().enumerate().map(|(i, v)| v + [0.3, -0.2, 0.1, 0.4, -0.5][i]).collect();
+        let r = lstsq_residuals(vec![vec![1.0; 5], x.clone()], &noisy);
+        assert!(r.iter().sum::<f64>().abs() < 1e-12);
+        assert!(r.iter().zip(&x).map(|(a, b)| a * b).sum::<f64>().abs() < 1e-12);
+    }
+
     #[test]
     fn fraction_clamping() {
         assert_eq!(clamp01(-0.5), 0.0);
@@ -0,0 +1,351 @@
+// Content-addressed on-disk cache of per-locus BWA-MEM indexes.
+//
+// Building a BWA index for a ~1 Mb V(D)J slice costs far more than aligning
+// the handful of soft-clipped reads we feed it, and every sample in a cohort
+// rebuilds the same six indexes.  Instead we build each index once, collapse
+// it into BWA's flat `bwa_idx2mem` image and store that under a key derived
+// from the slice content, its coordinates and the vendored BWA version.
+// Loading is an `mmap` + `bwa_mem2idx`: the BWT, SA and PAC point straight
+// into the read-only mapping, so every worker process on a node shares one
+// copy of each index through the page cache.
+//
+// Concurrent builders are safe: each writes to a private temp file inside
+// the cache directory and atomically renames it into place.
+//
+// `bwa_mem2idx` trusts the sizes recorded inside the image and asserts on a
+// mismatch, so every entry starts with a fixed header (magic, format, target
+// and image length) that is checked against the file size before mapping.
+// An entry that fails the check is rebuilt rather than handed to BWA.  The
+// image embeds native struct layouts, so the target (architecture, pointer
+// width, byte order) is also part of the key: nodes of different kinds can
+// share one cache directory without clobbering each other's entries.
+
+use std::io::Write;
+use std::path::{Path, PathBuf};
+use std::ptr;
+
+use crate::bwa_ffi::*;
+use crate::realign::RealignError;
+
+/// Bumped whenever the on-disk layout of a cache entry changes.
+const CACHE_FORMAT: u32 = 3;
+const ENTRY_SUFFIX: &str = "bwaidx";
+const ENTRY_MAGIC: &[u8; 8] = b"SHBWAIDX";
+/// magic, format (u32), target tag (u32), image length (u64).  A multiple
+/// of eight so the image stays 8-byte aligned inside the page-aligned
+/// mapping.
+const HEADER_LEN: usize = 24;
+
+pub struct IndexCache {
+    root: PathBuf,
+}
+
+impl IndexCache {
+    /// Open (creating if needed) the cache rooted at `root`, or at the
+    /// default location when `root` is `None`:
+    ///   $SPLITHUNTER_INDEX_CACHE, else $XDG_CACHE_HOME/splithunter/bwa,
+    ///   else ~/.cache/splithunter/bwa.
+    pub fn open(root: Option<&str>) -> Result<Self, RealignError> {
+        let root = match root {
+            Some(r) if !r.is_empty() => PathBuf::from(r),
+            _ => default_root(),
+        };
+        std::fs::create_dir_all(&root)
+            .map_err(|e| RealignError::Io(format!("create {}: {e}", root.display())))?;
+        Ok(Self { root })
+    }
+
+    pub fn root(&self) -> &Path {
+        &self.root
+    }
+
+    /// Path of the cache entry for a locus slice (whether or not it exists).
+    pub fn entry_path(&self, seq: &[u8], chrom: &str, start: i64, end: i64) -> PathBuf {
+        self.root
+            .join(format!("{}.{ENTRY_SUFFIX}", cache_key(seq, chrom, start, end)))
+    }
+
+    /// Return the entry for `seq`, building it first if it is missing or
+    /// fails the header check (truncated, corrupted or foreign).
+    pub fn ensure(
+        &self,
+        seq: &[u8],
+        chrom: &str,
+        start: i64,
+        end: i64,
+        locus_name: &str,
+    ) -> Result<PathBuf, RealignError> {
+        let entry = self.entry_path(seq, chrom, start, end);
+        if entry.is_file() && check_entry(&entry).is_ok() {
+            return Ok(entry);
+        }
+        self.build(seq, locus_name, &entry)?;
+        Ok(entry)
+    }
+
+    fn build(&self, seq: &[u8], locus_name: &str, entry: &Path) -> Result<(), RealignError> {
+        let scratch = tempfile::Builder::new()
+            .prefix(".build-")
+            .tempdir_in(&self.root)
+            .map_err(|e| RealignError::Io(e.to_string()))?;
+        let fasta_path = scratch.path().join(format!("{locus_name}.fa"));
+        let mut record = Vec::with_capacity(seq.len() + locus_name.len() + 3);
+        record.push(b'>');
+        record.extend_from_slice(locus_name.as_bytes());
+        record.push(b'\n');
+        record.extend_from_slice(seq);
+        record.push(b'\n');
+        std::fs::write(&fasta_path, record).map_err(|e| RealignError::Io(e.to_string()))?;
+
+        crate::realign::build_index(&fasta_path, &fasta_path)?;
+        let idx = crate::realign::load_index(&fasta_path)?;
+        let image = unsafe {
+            if bwa_idx2mem(idx) != 0 || (*idx).mem.is_null() {
+                bwa_idx_destroy(idx);
+                return Err(RealignError::LoadIndex("bwa_idx2mem failed".into()));
+            }
+            std::slice::from_raw_parts((*idx).mem, (*idx).l_mem as usize)
+        };
+
+        let written = tempfile::Builder::new()
+            .prefix(".entry-")
+            .tempfile_in(&self.root)
+            .and_then(|mut f| {
+                f.write_all(&entry_header(image.len() as u64))?;
+                f.write_all(image)?;
+                f.as_file().sync_all()?;
+                Ok(f)
+            });
+        unsafe { bwa_idx_destroy(idx) };
+        written
+            .map_err(|e| RealignError::Io(e.to_string()))?
+            .persist(entry)
+            .map_err(|e| RealignError::Io(format!("persist {}: {e}", entry.display())))?;
+        Ok(())
+    }
+}
+
+/// A read-only mapping of a cache entry.  Unmapped on drop; the `bwaidx_t`
+/// rebuilt over it must be destroyed first.
+pub struct Mapping {
+    ptr: *mut libc::c_void,
+    len: usize,
+}
+
+impl Drop for Mapping {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.ptr, self.len);
+        }
+    }
+}
+
+fn entry_header(image_len: u64) -> [u8; HEADER_LEN] {
+    let mut h = [0u8; HEADER_LEN];
+    h[..8].copy_from_slice(ENTRY_MAGIC);
+    h[8..12].copy_from_slice(&CACHE_FORMAT.to_le_bytes());
+    h[12..16].copy_from_slice(&target_tag().to_le_bytes());
+    h[16..24].copy_from_slice(&image_len.to_le_bytes());
+    h
+}
+
+/// Validate the header of an open entry against its file size and return
+/// the image length.
+fn check_header(file: &mut std::fs::File, entry: &Path) -> Result<usize, RealignError> {
+    use std::io::Read;
+    let bad =
+        |why: &str| RealignError::LoadIndex(format!("cache entry {}: {why}", entry.display()));
+    let len = file
+        .metadata()
+        .map_err(|e| RealignError::Io(e.to_string()))?
+        .len();
+    let mut h = [0u8; HEADER_LEN];
+    if len < HEADER_LEN as u64 || file.read_exact(&mut h).is_err() {
+        return Err(bad("truncated header"));
+    }
+    if &h[..8] != ENTRY_MAGIC {
+        return Err(bad("bad magic"));
+    }
+    if u32::from_le_bytes(h[8..12].try_into().unwrap()) != CACHE_FORMAT {
+        return Err(bad("format mismatch"));
+    }
+    if u32::from_le_bytes(h[12..16].try_into().unwrap()) != target_tag() {
+        return Err(bad("written for another target"));
+    }
+    let image_len = u64::from_le_bytes(h[16..24].try_into().unwrap());
+    if image_len == 0 || len != HEADER_LEN as u64 + image_len {
+        return Err(bad("size mismatch"));
+    }
+    Ok(image_len as usize)
+}
+
+fn check_entry(entry: &Path) -> Result<usize, RealignError> {
+    let mut file = std::fs::File::open(entry)
+        .map_err(|e| RealignError::Io(format!("open {}: {e}", entry.display())))?;
+    check_header(&mut file, entry)
+}
+
+/// Map `entry` and rebuild a `bwaidx_t` over the image that follows its
+/// header, without copying.  The returned index is flagged `is_shm` so
+/// `bwa_idx_destroy` leaves the mapping to `Mapping::drop`.
+pub fn load_mapped(entry: &Path) -> Result<(*mut bwaidx_t, Mapping), RealignError> {
+    let mut file = std::fs::File::open(entry)
+        .map_err(|e| RealignError::Io(format!("open {}: {e}", entry.display())))?;
+    let image_len = check_header(&mut file, entry)?;
+    let len = HEADER_LEN + image_len;
+    let ptr = unsafe {
+        use std::os::unix::io::AsRawFd;
+        libc::mmap(
+            ptr::null_mut(),
+            len,
+            libc::PROT_READ,
+            libc::MAP_SHARED,
+            file.as_raw_fd(),
+            0,
+        )
+    };
+    if ptr == libc::MAP_FAILED {
+        return Err(RealignError::Io(format!(
+            "mmap {}: {}",
+            entry.display(),
+            std::io::Error::last_os_error()
+        )));
+    }
+    let mapping = Mapping { ptr, len };
+
+    let idx = unsafe { libc::calloc(1, std::mem::size_of::<bwaidx_t>()) as *mut bwaidx_t };
+    if idx.is_null() {
+        return Err(RealignError::LoadIndex("calloc(bwaidx_t) failed".into()));
+    }
+    unsafe {
+        // bwa_mem2idx only reads through `mem`; the mutable pointer is an
+        // artefact of its C signature.
+        let image = (mapping.ptr as *mut u8).add(HEADER_LEN);
+        if bwa_mem2idx(image_len as i64, image, idx) != 0 {
+            libc::free(idx as *mut libc::c_void);
+            return Err(RealignError::LoadIndex(format!(
+                "bwa_mem2idx({}) failed",
+                entry.display()
+            )));
+        }
+        (*idx).is_shm = 1;
+    }
+    Ok((idx, mapping))
+}
+
+/// Hex key for a locus slice: FNV-1a over the cache format, BWA version,
+/// target, coordinates and the slice bases.  Hashing the bases makes the key
+/// content-addressed, so two references that agree on the slice share an
+/// entry and a patched reference never reuses a stale one.
+pub fn cache_key(seq: &[u8], chrom: &str, start: i64, end: i64) -> String {
+    let mut h = Fnv1a::new();
+    h.write(&CACHE_FORMAT.to_le_bytes());
+    h.write(BWA_VERSION.as_bytes());
+    h.write(&[0]);
+    write_target(&mut h);
+    h.write(chrom.as_bytes());
+    h.write(&[0]);
+    h.write(&start.to_le_bytes());
+    h.write(&end.to_le_bytes());
+    h.write(seq);
+    format!("{}-{}-{}-{:016x}", sanitize(chrom), start, end, h.finish())
+}
+
+/// Everything the `bwa_idx2mem` image layout depends on besides BWA itself.
+fn write_target(h: &mut Fnv1a) {
+    h.write(std::env::consts::ARCH.as_bytes());
+    h.write(&[0]);
+    h.write(&(std::mem::size_of::<usize>() as u32).to_le_bytes());
+    h.write(&[cfg!(target_endian = "little") as u8]);
+}
+
+/// Header form of `write_target`.
+fn target_tag() -> u32 {
+    let mut h = Fnv1a::new();
+    write_target(&mut h);
+    let v = h.finish();
+    (v ^ (v >> 32)) as u32
+}
+
+fn sanitize(s: &str) -> String {
+    s.chars()
+        .map(|c| if c.is_ascii_alphanumeric() || c == '_' || c == '.' { c } else { '_' })
+        .collect()
+}
+
+fn default_root() -> PathBuf {
+    if let Some(p) = std::env::var_os("SPLITHUNTER_INDEX_CACHE").filter(|p| !p.is_empty()) {
+        return PathBuf::from(p);
+    }
+    if let Some(p) = std::env::var_os("XDG_CACHE_HOME").filter(|p| !p.is_empty()) {
+        return PathBuf::from(p).join("splithunter").join("bwa");
+    }
+    if let Some(p) = std::env::var_os("HOME").filter(|p| !p.is_empty()) {
+        return PathBuf::from(p).join(".cache").join("splithunter").join("bwa");
+    }
+    std::env::temp_dir().join("splithunter-bwa")
+}
+
+/// 64-bit FNV-1a.  `std::hash::DefaultHasher` is not stable across Rust
+/// releases, which would silently invalidate every cache entry on upgrade.
+pub(crate) struct Fnv1a(u64);
+
+impl Fnv1a {
+    pub(crate) fn new() -> Self {
+        Self(0xcbf2_9ce4_8422_2325)
+    }
+    pub(crate) fn write(&mut self, bytes: &[u8]) {
+        for &b in bytes {
+            self.0 ^= b as u64;
+            self.0 = self.0.wrapping_mul(0x0000_0100_0000_01b3);
+        }
+    }
+    pub(crate) fn finish(&self) -> u64 {
+        self.0
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn cache_key_depends_on_content_and_coordinates() {
+        let a = cache_key(b"ACGTACGT", "chr14", 100, 108);
+        assert_eq!(a, cache_key(b"ACGTACGT", "chr14", 100, 108));
+        assert_ne!(a, cache_key(b"ACGTACGA", "chr14", 100, 108));
+        assert_ne!(a, cache_key(b"ACGTACGT", "14", 100, 108));
+        assert_ne!(a, cache_key(b"ACGTACGT", "chr14", 101, 109));
+        assert!(a.starts_with("chr14-100-108-"));
+    }
+
+    #[test]
+    fn entry_header_checks_magic_format_and_size() {
+        let dir = tempfile::tempdir().unwrap();
+        let entry = dir.path().join("x.bwaidx");
+        let mut bytes = entry_header(16).to_vec();
+        bytes.extend_from_slice(&[7u8; 16]);
+        std::fs::write(&entry, &bytes).unwrap();
+        assert_eq!(check_entry(&entry).unwrap(), 16);
+
+        std::fs::write(&entry, &bytes[..bytes.len() - 1]).unwrap();
+        assert!(check_entry(&entry).is_err());
+        std::fs::write(&entry, &bytes[..HEADER_LEN - 4]).unwrap();
+        assert!(check_entry(&entry).is_err());
+
+        let mut foreign = bytes.clone();
+        foreign[0] = b'X';
+        std::fs::write(&entry, &foreign).unwrap();
+        assert!(check_entry(&entry).is_err());
+
+        let mut stale = bytes.clone();
+        stale[8..12].copy_from_slice(&(CACHE_FORMAT - 1).to_le_bytes());
+        std::fs::write(&entry, &stale).unwrap();
+        assert!(check_entry(&entry).is_err());
+
+        let mut other_target = bytes.clone();
+        other_target[12..16].copy_from_slice(&(target_tag() ^ 1).to_le_bytes());
+        std::fs::write(&entry, &other_target).unwrap();
+        assert!(check_entry(&entry).is_err());
+    }
+}
@@ -1,29 +1,178 @@
 // Rust core for Splithunter.
 //
-// Two public entry points are exposed to Python:
-//   analyze_locus  — split-read / split-pair discovery in a BAM region.
-//   coverage_logr  — per-exon coverage log-ratio + TcellExTRECT-style fraction.
+// Entry points exposed to Python:
+//   analyze_locus    — split-read / split-pair discovery in one BAM region.
+//   analyze_sample   — the same over all loci of a sample, fused with their
+//                      depth tracks in one BAM pass.
+//   analyze_cohort   — every (sample, locus) pair of a run on one native
+//                      thread pool, streaming samples back as they finish.
+//   region_coverage, region_coverage_many
+//                    — CIGAR-walk depth tracks as NumPy arrays.
+//   tcell_fraction, fraction_from_coverage, upstream_fraction_from_coverage
+//                    — TcellExTRECT-style T-cell fraction from a BAM, from a
+//                      depth track, or exon-smoothed from a depth track.
+//   Realigner, prebuild_index
+//                    — per-locus BWA indexes from the persistent on-disk
+//                      cache, to reuse across calls or warm before a run.
+//
+// BAMs are read through `bamio::BamSource`: local paths or URLs, optionally
+// with htslib decoder threads and index-planned range prefetch.  Every entry
+// point releases the GIL while it reads BAMs, builds indexes or aligns, so
+// Python threads (and `analyze_cohort` workers) run concurrently.  The scan
+// entry points take `profile=True` to report per-stage timings
+// (`profile.rs`); `cargo bench` drives the hot paths directly through the
+// `bench` re-exports on data from `synth.rs`.
+
+use std::collections::{HashMap, HashSet};
+use std::sync::{mpsc, Arc, Mutex};
+use std::time::{Duration, Instant};
 
+use numpy::{AllowTypeChange, IntoPyArray, PyArray1, PyArrayLike1, PyReadonlyArray1};
 use pyo3::prelude::*;
-use pyo3::types::{PyDict, PyList};
+use pyo3::types::PyDict;
 
 mod entropy;
 mod coverage;
 mod split;
 mod bwa_ffi;
+mod index_cache;
 mod realign;
+mod sample;
+mod cohort;
+mod prescreen;
+mod bamio;
+mod profile;
+#[cfg(any(test, feature = "bench"))]
+mod synth;
+
+/// Internals used by `benches/`; not a stable API.
+#[cfg(feature = "bench")]
+#[doc(hidden)]
+pub mod bench {
+    pub use crate::bamio::IoConfig;
+    pub use crate::coverage::{fraction_from_positions, region_coverage};
+    pub use crate::entropy::trinucleotide_entropy;
+    pub use crate::realign::Realigner;
+    pub use crate::split::analyze;
+    pub use crate::synth::{simulate, write, SynthParams};
+}
+
+/// A loaded per-locus BWA-MEM index, backed by the on-disk index cache.
+///
+/// Build once per locus and pass to `analyze_locus(..., realigner=...)` to
+/// skip the per-call index build.  `cache_dir=None` uses the default cache
+/// location ($SPLITHUNTER_INDEX_CACHE, $XDG_CACHE_HOME/splithunter/bwa or
+/// ~/.cache/splithunter/bwa).
+#[pyclass(name = "Realigner", module = "splithunter._core", frozen)]
+struct PyRealigner {
+    inner: Arc<realign::Realigner>,
+}
+
+#[pymethods]
+impl PyRealigner {
+    #[new]
+    #[pyo3(signature = (reference_fasta, name, chrom, start, end, cache_dir=None))]
+    fn new(
+        py: Python<'_>,
+        reference_fasta: &str,
+        name: &str,
+        chrom: &str,
+        start: i64,
+        end: i64,
+        cache_dir: Option<&str>,
+    ) -> PyResult<Self> {
+        let realigner = py.allow_threads(|| {
+            cached_realigner(reference_fasta, name, chrom, start, end, cache_dir)
+        })?;
+        Ok(Self { inner: Arc::new(realigner) })
+    }
+
+    #[getter]
+    fn name(&self) -> &str {
+        self.inner.contig_name()
+    }
+
+    #[getter]
+    fn chrom(&self) -> &str {
+        self.inner.chrom()
+    }
+
+    #[getter]
+    fn span(&self) -> (i64, i64) {
+        self.inner.span()
+    }
+
+    #[getter]
+    fn index_path(&self) -> Option<String> {
+        self.inner.index_path().map(|p| p.display().to_string())
+    }
+}
+
+fn cached_realigner(
+    reference_fasta: &str,
+    name: &str,
+    chrom: &str,
+    start: i64,
+    end: i64,
+    cache_dir: Option<&str>,
+) -> PyResult<realign::Realigner> {
+    let cache = index_cache::IndexCache::open(cache_dir)
+        .map_err(|e| pyo3::exceptions::PyRuntimeError::new_err(format!("{e}")))?;
+    realign::Realigner::from_cache(&cache, reference_fasta, chrom, start, end, name)
+        .map_err(|e| pyo3::exceptions::PyRuntimeError::new_err(format!("{e}")))
+}
+
+/// Build (if missing) the cached BWA index for a locus slice and return the
+/// path of the cache entry.  Used to warm the cache ahead of a cohort run.
+#[pyfunction]
+#[pyo3(signature = (reference_fasta, name, chrom, start, end, cache_dir=None))]
+fn prebuild_index(
+    py: Python<'_>,
+    reference_fasta: &str,
+    name: &str,
+    chrom: &str,
+    start: i64,
+    end: i64,
+    cache_dir: Option<&str>,
+) -> PyResult<String> {
+    py.allow_threads(|| {
+        let cache = index_cache::IndexCache::open(cache_dir)
+            .map_err(|e| pyo3::exceptions::PyRuntimeError::new_err(format!("{e}")))?;
+        let seq = realign::fetch_slice(reference_fasta, chrom, start, end)
+            .map_err(|e| pyo3::exceptions::PyRuntimeError::new_err(format!("{e}")))?;
+        let entry = cache
+            .ensure(seq.as_bytes(), chrom, start, end, name)
+            .map_err(|e| pyo3::exceptions::PyRuntimeError::new_err(format!("{e}")))?;
+        Ok(entry.display().to_string())
+    })
+}
 
 /// Analyze a genomic region of a BAM for split-read (SR) and split-pair (SP)
 /// evidence.  The returned dict mirrors the JSON schema emitted by the legacy
 /// C++ Splithunter binary:
 ///     <name>.SR-TOTAL, .SR-SIGNAL, .SR-PPM, .SR-DETAILS
 ///     <name>.SP-TOTAL, .SP-SIGNAL, .SP-PPM, .SP-DETAILS
+/// plus diagnostics: .SP-PEAK-PENDING/-BYTES (mate cache high-water mark),
+/// .SR-PRESCREENED (clipped reads dropped by the seed screen),
+/// .SR-LOWCOMPLEXITY (splits rejected on entropy before half realignment)
+/// and .SR-CACHE-HITS/-MISSES (memoized realignments).
+///
+/// With `profile`, each locus also gets .PROFILE-* keys: wall seconds per
+/// stage (INDEX, FETCH, DECODE, SOFTCLIP, PRESCREEN, REALIGN, ENTROPY,
+/// PAIRSCAN) and READS-SCANNED, READS-REALIGNED, MEM-ALIGN1-CALLS and
+/// PEAK-PAIR-CACHE.  INDEX is only non-zero when this call built or loaded
+/// the index.
 ///
 /// `reference_fasta` must be an indexed (FAI) FASTA; the locus slice it
-/// yields is used to build a per-call in-memory BWA-MEM index for re-aligning
-/// soft-clipped reads, matching the C++ tool's fidelity.
+/// yields is used to build a per-locus BWA-MEM index for re-aligning
+/// soft-clipped reads, matching the C++ tool's fidelity.  Pass a prebuilt
+/// `realigner` to reuse a loaded index, or `index_cache` to load/build the
+/// index through the persistent cache; otherwise a throwaway index is built
+/// for this call.  `threads` worker threads realign soft-clipped candidates;
+/// the result does not depend on the thread count.  The I/O options are
+/// those of `analyze_sample`.
 #[pyfunction]
-#[pyo3(signature = (bam_path, name, chrom, start, end, reference_fasta, pad=30, indel=10_000, min_entropy=50.0))]
+#[pyo3(signature = (bam_path, name, chrom, start, end, reference_fasta, pad=30, indel=10_000, min_entropy=50.0, realigner=None, index_cache=None, threads=1, io_threads=1, prefetch=false, prefetch_gap=1_048_576, prefetch_buffer=268_435_456, prefetch_requests=4, profile=false))]
 #[allow(clippy::too_many_arguments)]
 fn analyze_locus<'py>(
     py: Python<'py>,
@@ -36,15 +185,74 @@ fn analyze_locus<'py>(
     pad: i64,
     indel: i64,
     min_entropy: f64,
+    realigner: Option<PyRef<'py, PyRealigner>>,
+    index_cache: Option<&str>,
+    threads: usize,
+    io_threads: usize,
+    prefetch: bool,
+    prefetch_gap: u64,
+    prefetch_buffer: u64,
+    prefetch_requests: usize,
+    profile: bool,
 ) -> PyResult<Bound<'py, PyDict>> {
-    let realigner = realign::Realigner::from_reference(reference_fasta, chrom, start, end, name)
-        .map_err(|e| pyo3::exceptions::PyRuntimeError::new_err(format!("{e}")))?;
-    let summary = split::analyze(bam_path, chrom, start, end, pad, indel, min_entropy, &realigner)
+    let given: Option<Arc<realign::Realigner>> = match &realigner {
+        Some(r) => {
+            if !r.inner.covers(name, chrom, start, end) {
+                return Err(pyo3::exceptions::PyValueError::new_err(format!(
+                    "realigner covers {} {}:{}-{}, not {name} {chrom}:{start}-{end}",
+                    r.inner.contig_name(),
+                    r.inner.chrom(),
+                    r.inner.span().0,
+                    r.inner.span().1,
+                )));
+            }
+            Some(r.inner.clone())
+        }
+        None => None,
+    };
+    let io = io_config(io_threads, prefetch, prefetch_gap, prefetch_buffer, prefetch_requests);
+    let summary = py.allow_threads(|| -> PyResult<_> {
+        let built = Instant::now();
+        let realigner = match given {
+            Some(r) => r,
+            None => Arc::new(build_realigner(reference_fasta, name, chrom, start, end, index_cache)?),
+        };
+        let index_seconds = built.elapsed().as_secs_f64();
+        let mut summary = split::analyze(
+            bam_path, chrom, start, end, pad, indel, min_entropy, &realigner, threads, io, profile,
+        )
         .map_err(|e| pyo3::exceptions::PyRuntimeError::new_err(format!("{e}")))?;
+        if let Some(p) = summary.profile.as_mut() {
+            p.index_seconds = index_seconds;
+        }
+        Ok(summary)
+    })?;
+
+    let dict = PyDict::new_bound(py);
+    set_summary_items(&dict, name, summary)?;
+    Ok(dict)
+}
 
+/// Load the index for a locus through `index_cache`, or build a throwaway
+/// one when no cache directory is given.
+fn build_realigner(
+    reference_fasta: &str,
+    name: &str,
+    chrom: &str,
+    start: i64,
+    end: i64,
+    index_cache: Option<&str>,
+) -> PyResult<realign::Realigner> {
+    match index_cache {
+        Some(dir) => cached_realigner(reference_fasta, name, chrom, start, end, Some(dir)),
+        None => realign::Realigner::from_reference(reference_fasta, chrom, start, end, name)
+            .map_err(|e| pyo3::exceptions::PyRuntimeError::new_err(format!("{e}"))),
+    }
+}
+
+fn set_summary_items(dict: &Bound<'_, PyDict>, name: &str, summary: split::Summary) -> PyResult<()> {
     let sr_ppm = summary.sr_ppm();
     let sp_ppm = summary.sp_ppm();
-    let dict = PyDict::new_bound(py);
     dict.set_item(format!("{name}.SR-TOTAL"), summary.sr_total)?;
     dict.set_item(format!("{name}.SR-SIGNAL"), summary.sr_signal)?;
     dict.set_item(format!("{name}.SR-PPM"), sr_ppm)?;
@@ -53,13 +261,387 @@ fn analyze_locus<'py>(
     dict.set_item(format!("{name}.SP-SIGNAL"), summary.sp_signal)?;
     dict.set_item(format!("{name}.SP-PPM"), sp_ppm)?;
     dict.set_item(format!("{name}.SP-DETAILS"), summary.sp_details)?;
-    Ok(dict)
+    dict.set_item(format!("{name}.SP-PEAK-PENDING"), summary.sp_peak_pending)?;
+    dict.set_item(format!("{name}.SP-PEAK-BYTES"), summary.sp_peak_bytes)?;
+    dict.set_item(format!("{name}.SR-PRESCREENED"), summary.sr_prescreened)?;
+    dict.set_item(format!("{name}.SR-LOWCOMPLEXITY"), summary.sr_low_complexity)?;
+    dict.set_item(format!("{name}.SR-CACHE-HITS"), summary.sr_cache_hits)?;
+    dict.set_item(format!("{name}.SR-CACHE-MISSES"), summary.sr_cache_misses)?;
+    if let Some(p) = summary.profile {
+        dict.set_item(format!("{name}.PROFILE-INDEX-SECONDS"), p.index_seconds)?;
+        dict.set_item(format!("{name}.PROFILE-FETCH-SECONDS"), p.fetch_seconds)?;
+        dict.set_item(format!("{name}.PROFILE-DECODE-SECONDS"), p.decode_seconds)?;
+        dict.set_item(format!("{name}.PROFILE-SOFTCLIP-SECONDS"), p.soft_clip_seconds)?;
+        dict.set_item(format!("{name}.PROFILE-PRESCREEN-SECONDS"), p.prescreen_seconds)?;
+        dict.set_item(format!("{name}.PROFILE-REALIGN-SECONDS"), p.realign_seconds)?;
+        dict.set_item(format!("{name}.PROFILE-ENTROPY-SECONDS"), p.entropy_seconds)?;
+        dict.set_item(format!("{name}.PROFILE-PAIRSCAN-SECONDS"), p.pair_scan_seconds)?;
+        dict.set_item(format!("{name}.PROFILE-READS-SCANNED"), p.reads_scanned)?;
+        dict.set_item(format!("{name}.PROFILE-READS-REALIGNED"), p.reads_realigned)?;
+        dict.set_item(format!("{name}.PROFILE-MEM-ALIGN1-CALLS"), p.mem_align1_calls)?;
+        dict.set_item(format!("{name}.PROFILE-PEAK-PAIR-CACHE"), p.peak_pair_cache)?;
+    }
+    Ok(())
 }
 
-/// Per-position coverage across a region; returned as a list of (pos, depth)
-/// tuples.  Filters duplicate and secondary alignments by default.
+/// Analyze every locus of one sample in a single pass over the BAM.
+///
+/// `loci` is a list of `(name, chrom, start, end)`.  The file is opened once
+/// and each locus window fetched once; that record stream drives SR/SP
+/// detection and, for loci listed in `coverage` (`{name: (start, end)}`), a
+/// depth track with `region_coverage` semantics.  Returns
+/// `(summary, coverage)`: `summary` holds the same `<name>.SR-*`/`SP-*` keys
+/// as `analyze_locus`, `coverage` maps locus name to `(positions, depths)`.
+///
+/// `realigners`, if given, is a list parallel to `loci`; otherwise indexes
+/// come from `index_cache` (or are built per call when that is `None`).
+///
+/// `bam_path` may be a URL.  `io_threads` htslib threads decode BGZF/CRAM
+/// blocks.  With `prefetch`, the compressed ranges of every locus window are
+/// looked up in the index up front, ranges within `prefetch_gap` bytes are
+/// merged, and `prefetch_requests` concurrent reads fill a buffer of at most
+/// `prefetch_buffer` bytes ahead of decoding.  None of these change the
+/// results.  `summary` also carries IO-BYTES-READ, IO-REQUESTS,
+/// IO-PREFETCH-HITS and IO-DECODE-SECONDS for the sample.  Bytes and
+/// requests are only measured through the prefetch backend and are `None`
+/// when the BAM was read any other way.
+/// `profile` adds the `analyze_locus` .PROFILE-* keys for every locus.
 #[pyfunction]
-#[pyo3(signature = (bam_path, chrom, start, end, min_mapq=1))]
+#[pyo3(signature = (bam_path, loci, reference_fasta, pad=30, indel=10_000, min_entropy=50.0, realigners=None, index_cache=None, threads=1, coverage=None, min_mapq=1, io_threads=1, prefetch=false, prefetch_gap=1_048_576, prefetch_buffer=268_435_456, prefetch_requests=4, profile=false))]
+#[allow(clippy::too_many_arguments)]
+fn analyze_sample<'py>(
+    py: Python<'py>,
+    bam_path: &str,
+    loci: Vec<(String, String, i64, i64)>,
+    reference_fasta: &str,
+    pad: i64,
+    indel: i64,
+    min_entropy: f64,
+    realigners: Option<Vec<PyRef<'py, PyRealigner>>>,
+    index_cache: Option<&str>,
+    threads: usize,
+    coverage: Option<HashMap<String, (i64, i64)>>,
+    min_mapq: u8,
+    io_threads: usize,
+    prefetch: bool,
+    prefetch_gap: u64,
+    prefetch_buffer: u64,
+    prefetch_requests: usize,
+    profile: bool,
+) -> PyResult<(Bound<'py, PyDict>, Bound<'py, PyDict>)> {
+    let specs = locus_specs(loci, coverage);
+    let given: Option<Vec<Arc<realign::Realigner>>> = match realigners {
+        Some(given) => {
+            if given.len() != specs.len() {
+                return Err(pyo3::exceptions::PyValueError::new_err(
+                    "realigners and loci must have the same length",
+                ));
+            }
+            for (r, spec) in given.iter().zip(specs.iter()) {
+                if !r.inner.covers(&spec.name, &spec.chrom, spec.start, spec.end) {
+                    return Err(pyo3::exceptions::PyValueError::new_err(format!(
+                        "realigner for {} does not cover {} {}:{}-{}",
+                        r.inner.contig_name(), spec.name, spec.chrom, spec.start, spec.end,
+                    )));
+                }
+            }
+            Some(given.iter().map(|r| r.inner.clone()).collect())
+        }
+        None => None,
+    };
+    let io = io_config(io_threads, prefetch, prefetch_gap, prefetch_buffer, prefetch_requests);
+    let params = sample::ScanParams { pad, indel, min_entropy, min_mapq, threads, io, profile };
+
+    let outputs = py.allow_threads(|| -> PyResult<_> {
+        let mut index_seconds = vec![0.0; specs.len()];
+        let realigners: Vec<Arc<realign::Realigner>> = match given {
+            Some(given) => given,
+            None => specs
+                .iter()
+                .zip(index_seconds.iter_mut())
+                .map(|(spec, seconds)| -> PyResult<_> {
+                    let built = Instant::now();
+                    let realigner = build_realigner(
+                        reference_fasta, &spec.name, &spec.chrom, spec.start, spec.end, index_cache,
+                    )?;
+                    *seconds = built.elapsed().as_secs_f64();
+                    Ok(Arc::new(realigner))
+                })
+                .collect::<PyResult<_>>()?,
+        };
+        let refs: Vec<&realign::Realigner> = realigners.iter().map(|r| r.as_ref()).collect();
+        let mut outputs = sample::analyze_sample(bam_path, &specs, &refs, params)
+            .map_err(|e| pyo3::exceptions::PyRuntimeError::new_err(format!("{e}")))?;
+        for (output, seconds) in outputs.iter_mut().zip(index_seconds) {
+            if let Some(p) = output.summary.profile.as_mut() {
+                p.index_seconds = seconds;
+            }
+        }
+        Ok(outputs)
+    })?;
+
+    let summary = PyDict::new_bound(py);
+    let tracks = PyDict::new_bound(py);
+    let mut io = bamio::IoStats::default();
+    for (spec, output) in specs.iter().zip(outputs) {
+        set_summary_items(&summary, &spec.name, output.summary)?;
+        if let Some(cov) = output.coverage {
+            tracks.set_item(&spec.name, depth_arrays(py, cov))?;
+        }
+        io.add(&output.io);
+    }
+    set_io_items(&summary, &io)?;
+    Ok((summary, tracks))
+}
+
+fn io_config(
+    io_threads: usize,
+    prefetch: bool,
+    prefetch_gap: u64,
+    prefetch_buffer: u64,
+    prefetch_requests: usize,
+) -> bamio::IoConfig {
+    bamio::IoConfig {
+        decode_threads: io_threads,
+        prefetch,
+        coalesce_gap: prefetch_gap,
+        buffer_bytes: prefetch_buffer,
+        fetchers: prefetch_requests.max(1),
+    }
+}
+
+fn set_io_items(dict: &Bound<'_, PyDict>, io: &bamio::IoStats) -> PyResult<()> {
+    dict.set_item("IO-BYTES-READ", io.counted.then_some(io.bytes_read))?;
+    dict.set_item("IO-REQUESTS", io.counted.then_some(io.requests))?;
+    dict.set_item("IO-PREFETCH-HITS", io.prefetch_hits)?;
+    dict.set_item("IO-DECODE-SECONDS", io.decode_seconds)?;
+    Ok(())
+}
+
+fn locus_specs(
+    loci: Vec<(String, String, i64, i64)>,
+    coverage: Option<HashMap<String, (i64, i64)>>,
+) -> Vec<sample::LocusSpec> {
+    let coverage = coverage.unwrap_or_default();
+    loci.into_iter()
+        .map(|(name, chrom, start, end)| sample::LocusSpec {
+            coverage: coverage.get(&name).copied(),
+            name,
+            chrom,
+            start,
+            end,
+        })
+        .collect()
+}
+
+/// Per-sample input of `analyze_cohort`:
+/// `(sample_key, bam_path, loci, coverage)`, where `loci` and `coverage`
+/// are as for `analyze_sample`.
+type CohortSample = (
+    String,
+    String,
+    Vec<(String, String, i64, i64)>,
+    Option<HashMap<String, (i64, i64)>>,
+);
+
+/// Analyze a whole cohort on a pool of `workers` native threads.
+///
+/// Every `(sample, locus)` pair is a task; idle workers take the next
+/// pending task from any sample, and all of them share one BWA index per
+/// locus.  `realigners` may supply loaded indexes (matched to loci by name,
+/// chromosome and span); the rest are loaded through `index_cache`, or
+/// built once for the run when that is `None`.  A supplied realigner that
+/// matches no locus, or a sample key given twice, raises `ValueError`.
+/// `threads` realignment threads run inside each task.  The `io_threads`
+/// and `prefetch*` options are as for `analyze_sample` and apply to every
+/// worker's open BAM.  With `profile`, each locus gets the .PROFILE-* keys;
+/// indexes are shared by the whole cohort, so PROFILE-INDEX-SECONDS is 0
+/// here.
+///
+/// Returns an iterator that yields `(sample_key, summary, coverage, error)`
+/// for each sample as soon as all its loci are done, in completion order.
+/// `summary` and `coverage` are what `analyze_sample` returns for it, or
+/// `None` with `error` set when the sample failed.
+#[pyfunction]
+#[pyo3(signature = (samples, reference_fasta, pad=30, indel=10_000, min_entropy=50.0, realigners=None, index_cache=None, workers=1, threads=1, min_mapq=1, io_threads=1, prefetch=false, prefetch_gap=1_048_576, prefetch_buffer=268_435_456, prefetch_requests=4, profile=false))]
+#[allow(clippy::too_many_arguments)]
+fn analyze_cohort<'py>(
+    py: Python<'py>,
+    samples: Vec<CohortSample>,
+    reference_fasta: &str,
+    pad: i64,
+    indel: i64,
+    min_entropy: f64,
+    realigners: Option<Vec<PyRef<'py, PyRealigner>>>,
+    index_cache: Option<&str>,
+    workers: usize,
+    threads: usize,
+    min_mapq: u8,
+    io_threads: usize,
+    prefetch: bool,
+    prefetch_gap: u64,
+    prefetch_buffer: u64,
+    prefetch_requests: usize,
+    profile: bool,
+) -> PyResult<PyCohortRun> {
+    let given: Vec<Arc<realign::Realigner>> = realigners
+        .unwrap_or_default()
+        .iter()
+        .map(|r| r.inner.clone())
+        .collect();
+    // Results are keyed by sample, so a repeated key would mix two samples.
+    let mut keys = HashSet::with_capacity(samples.len());
+    for (key, ..) in &samples {
+        if !keys.insert(key.as_str()) {
+            return Err(pyo3::exceptions::PyValueError::new_err(format!(
+                "duplicate sample key {key}"
+            )));
+        }
+    }
+    for r in &given {
+        let used = samples.iter().any(|(_, _, loci, _)| {
+            loci.iter()
+                .any(|(name, chrom, start, end)| r.covers(name, chrom, *start, *end))
+        });
+        if !used {
+            return Err(pyo3::exceptions::PyValueError::new_err(format!(
+                "realigner for {} {}:{}-{} matches no locus",
+                r.contig_name(),
+                r.chrom(),
+                r.span().0,
+                r.span().1,
+            )));
+        }
+    }
+    let io = io_config(io_threads, prefetch, prefetch_gap, prefetch_buffer, prefetch_requests);
+    let params = sample::ScanParams { pad, indel, min_entropy, min_mapq, threads, io, profile };
+
+    let (samples, realigners) = py.allow_threads(|| -> PyResult<_> {
+        // One realigner per distinct locus slice, shared by every sample.
+        let mut realigners: Vec<Arc<realign::Realigner>> = Vec::new();
+        let mut by_slice: HashMap<(String, String, i64, i64), usize> = HashMap::new();
+        let mut specs = Vec::with_capacity(samples.len());
+        for (key, bam, loci, coverage) in samples {
+            let loci = locus_specs(loci, coverage);
+            let mut indexes = Vec::with_capacity(loci.len());
+            for spec in &loci {
+                let slice = (spec.name.clone(), spec.chrom.clone(), spec.start, spec.end);
+                if let Some(&i) = by_slice.get(&slice) {
+                    indexes.push(i);
+                    continue;
+                }
+                let realigner = match given
+                    .iter()
+                    .find(|r| r.covers(&spec.name, &spec.chrom, spec.start, spec.end))
+                {
+                    Some(r) => r.clone(),
+                    None => Arc::new(build_realigner(
+                        reference_fasta, &spec.name, &spec.chrom, spec.start, spec.end, index_cache,
+                    )?),
+                };
+                realigners.push(realigner);
+                by_slice.insert(slice, realigners.len() - 1);
+                indexes.push(realigners.len() - 1);
+            }
+            specs.push(cohort::SampleSpec { key, bam, loci, realigners: indexes });
+        }
+        Ok((specs, realigners))
+    })?;
+
+    // A little slack so workers rarely wait on a slow consumer.
+    let (tx, rx) = mpsc::sync_channel(workers.max(1) * 2);
+    let handle = std::thread::Builder::new()
+        .name("splithunter-cohort".into())
+        .spawn(move || cohort::run(&samples, &realigners, params, workers, tx))
+        .map_err(|e| pyo3::exceptions::PyRuntimeError::new_err(format!("{e}")))?;
+    Ok(PyCohortRun {
+        rx: Mutex::new(rx),
+        handle: Mutex::new(Some(handle)),
+    })
+}
+
+/// Results of `analyze_cohort`, yielded per sample as they complete.
+/// Dropping the iterator early stops the run after in-flight tasks.
+#[pyclass(name = "CohortRun", module = "splithunter._core", frozen)]
+struct PyCohortRun {
+    rx: Mutex<mpsc::Receiver<cohort::SampleResult>>,
+    handle: Mutex<Option<std::thread::JoinHandle<()>>>,
+}
+
+#[pymethods]
+impl PyCohortRun {
+    fn __iter__(slf: PyRef<'_, Self>) -> PyRef<'_, Self> {
+        slf
+    }
+
+    #[allow(clippy::type_complexity)]
+    fn __next__<'py>(
+        &self,
+        py: Python<'py>,
+    ) -> PyResult<Option<(String, Option<Bound<'py, PyDict>>, Option<Bound<'py, PyDict>>, Option<String>)>>
+    {
+        loop {
+            // Wake up now and then so Ctrl-C reaches Python during a long run.
+            let next = py.allow_threads(|| {
+                self.rx.lock().unwrap().recv_timeout(Duration::from_millis(200))
+            });
+            let result = match next {
+                Ok(result) => result,
+                Err(mpsc::RecvTimeoutError::Timeout) => {
+                    py.check_signals()?;
+                    continue;
+                }
+                Err(mpsc::RecvTimeoutError::Disconnected) => {
+                    let handle = self.handle.lock().unwrap().take();
+                    if let Some(handle) = handle {
+                        if py.allow_threads(|| handle.join()).is_err() {
+                            return Err(pyo3::exceptions::PyRuntimeError::new_err(
+                                "cohort worker panicked",
+                            ));
+                        }
+                    }
+                    return Ok(None);
+                }
+            };
+            return match result.outputs {
+                Ok(outputs) => {
+                    let summary = PyDict::new_bound(py);
+                    let tracks = PyDict::new_bound(py);
+                    let mut io = bamio::IoStats::default();
+                    for (name, output) in outputs {
+                        set_summary_items(&summary, &name, output.summary)?;
+                        if let Some(cov) = output.coverage {
+                            tracks.set_item(&name, depth_arrays(py, cov))?;
+                        }
+                        io.add(&output.io);
+                    }
+                    set_io_items(&summary, &io)?;
+                    Ok(Some((result.key, Some(summary), Some(tracks), None)))
+                }
+                Err(e) => Ok(Some((result.key, None, None, Some(e)))),
+            };
+        }
+    }
+}
+
+type DepthArrays<'py> = (Bound<'py, PyArray1<i32>>, Bound<'py, PyArray1<i32>>);
+
+/// Hand a depth track to NumPy.  The arrays take ownership of the Rust
+/// buffers, so nothing is copied.
+fn depth_arrays(py: Python<'_>, track: coverage::DepthTrack) -> DepthArrays<'_> {
+    (
+        track.positions.into_pyarray_bound(py),
+        track.depths.into_pyarray_bound(py),
+    )
+}
+
+/// Per-position coverage across a region, returned as a pair of `int32`
+/// NumPy arrays `(positions, depths)`.  Filters duplicate, secondary,
+/// supplementary, QC-fail and low-MAPQ alignments; deletions count as zero.
+/// The I/O options are those of `analyze_sample`.
+#[pyfunction]
+#[pyo3(signature = (bam_path, chrom, start, end, min_mapq=1, io_threads=1, prefetch=false, prefetch_gap=1_048_576, prefetch_buffer=268_435_456, prefetch_requests=4))]
+#[allow(clippy::too_many_arguments)]
 fn region_coverage<'py>(
     py: Python<'py>,
     bam_path: &str,
@@ -67,23 +649,53 @@ fn region_coverage<'py>(
     start: i64,
     end: i64,
     min_mapq: u8,
-) -> PyResult<Bound<'py, PyList>> {
-    let cov = coverage::region_coverage(bam_path, chrom, start, end, min_mapq)
+    io_threads: usize,
+    prefetch: bool,
+    prefetch_gap: u64,
+    prefetch_buffer: u64,
+    prefetch_requests: usize,
+) -> PyResult<DepthArrays<'py>> {
+    let io = io_config(io_threads, prefetch, prefetch_gap, prefetch_buffer, prefetch_requests);
+    let cov = py
+        .allow_threads(|| coverage::region_coverage(bam_path, chrom, start, end, min_mapq, io))
         .map_err(|e| pyo3::exceptions::PyRuntimeError::new_err(format!("{e}")))?;
-    let list = PyList::empty_bound(py);
-    for (pos, depth) in cov {
-        list.append((pos, depth))?;
-    }
-    Ok(list)
+    Ok(depth_arrays(py, cov))
+}
+
+/// `region_coverage` restricted to a set of half-open `(start, end)`
+/// intervals on one contig (e.g. a capture-kit BED), computed in one pass.
+/// Positions are sorted and reported once even where intervals overlap.
+/// With `prefetch`, every interval group is planned before the first fetch.
+#[pyfunction]
+#[pyo3(signature = (bam_path, chrom, intervals, min_mapq=1, io_threads=1, prefetch=false, prefetch_gap=1_048_576, prefetch_buffer=268_435_456, prefetch_requests=4))]
+#[allow(clippy::too_many_arguments)]
+fn region_coverage_many<'py>(
+    py: Python<'py>,
+    bam_path: &str,
+    chrom: &str,
+    intervals: Vec<(i64, i64)>,
+    min_mapq: u8,
+    io_threads: usize,
+    prefetch: bool,
+    prefetch_gap: u64,
+    prefetch_buffer: u64,
+    prefetch_requests: usize,
+) -> PyResult<DepthArrays<'py>> {
+    let io = io_config(io_threads, prefetch, prefetch_gap, prefetch_buffer, prefetch_requests);
+    let cov = py
+        .allow_threads(|| coverage::region_coverage_many(bam_path, chrom, &intervals, min_mapq, io))
+        .map_err(|e| pyo3::exceptions::PyRuntimeError::new_err(format!("{e}")))?;
+    Ok(depth_arrays(py, cov))
 }
 
 /// TcellExTRECT-style log-ratio estimate.
 ///
 /// Given a focal (V–J) region flanked by two baseline windows, compute the
 /// median log2(focal / baseline) coverage ratio and derive a T-cell fraction
-/// estimate (1 − 2^logR, clamped to [0, 1]).
+/// estimate (1 − 2^logR, clamped to [0, 1]).  The I/O options are those of
+/// `analyze_sample`.
 #[pyfunction]
-#[pyo3(signature = (bam_path, chrom, focal_start, focal_end, left_start, left_end, right_start, right_end, min_mapq=1, min_cov=1, target_mask=None))]
+#[pyo3(signature = (bam_path, chrom, focal_start, focal_end, left_start, left_end, right_start, right_end, min_mapq=1, min_cov=1, target_mask=None, io_threads=1, prefetch=false, prefetch_gap=1_048_576, prefetch_buffer=268_435_456, prefetch_requests=4))]
 #[allow(clippy::too_many_arguments)]
 fn tcell_fraction<'py>(
     py: Python<'py>,
@@ -98,19 +710,29 @@ fn tcell_fraction<'py>(
     min_mapq: u8,
     min_cov: u32,
     target_mask: Option<Vec<(i64, i64)>>,
+    io_threads: usize,
+    prefetch: bool,
+    prefetch_gap: u64,
+    prefetch_buffer: u64,
+    prefetch_requests: usize,
 ) -> PyResult<Bound<'py, PyDict>> {
     let target_mask = target_mask.unwrap_or_default();
-    let result = coverage::tcell_fraction(
-        bam_path,
-        chrom,
-        (focal_start, focal_end),
-        (left_start, left_end),
-        (right_start, right_end),
-        min_mapq,
-        min_cov,
-        &target_mask,
-    )
-    .map_err(|e| pyo3::exceptions::PyRuntimeError::new_err(format!("{e}")))?;
+    let io = io_config(io_threads, prefetch, prefetch_gap, prefetch_buffer, prefetch_requests);
+    let result = py
+        .allow_threads(|| {
+            coverage::tcell_fraction(
+                bam_path,
+                chrom,
+                (focal_start, focal_end),
+                (left_start, left_end),
+                (right_start, right_end),
+                min_mapq,
+                min_cov,
+                &target_mask,
+                io,
+            )
+        })
+        .map_err(|e| pyo3::exceptions::PyRuntimeError::new_err(format!("{e}")))?;
 
     let dict = PyDict::new_bound(py);
     dict.set_item("baseline_median", result.baseline_median)?;
@@ -125,15 +747,17 @@ fn tcell_fraction<'py>(
 }
 
 /// Pure-compute variant of `tcell_fraction` — takes pre-computed coverage as
-/// parallel `positions` + `depths` lists.  Matches the R TcellExTRECT signature
-/// where the first argument is a coverage DataFrame.
+/// parallel `positions` + `depths` arrays.  Matches the R TcellExTRECT signature
+/// where the first argument is a coverage DataFrame.  Contiguous `int32`
+/// arrays (the dtype `region_coverage` returns) are read in place; lists and
+/// other dtypes are converted first.
 #[pyfunction]
 #[pyo3(signature = (positions, depths, focal_start, focal_end, left_start, left_end, right_start, right_end, min_cov=1, target_mask=None))]
 #[allow(clippy::too_many_arguments)]
 fn fraction_from_coverage<'py>(
     py: Python<'py>,
-    positions: Vec<i64>,
-    depths: Vec<u32>,
+    positions: PyArrayLike1<'py, i32, AllowTypeChange>,
+    depths: PyArrayLike1<'py, i32, AllowTypeChange>,
     focal_start: i64,
     focal_end: i64,
     left_start: i64,
@@ -143,21 +767,29 @@ fn fraction_from_coverage<'py>(
     min_cov: u32,
     target_mask: Option<Vec<(i64, i64)>>,
 ) -> PyResult<Bound<'py, PyDict>> {
+    let positions = positions.as_slice()?;
+    let depths = depths.as_slice()?;
     if positions.len() != depths.len() {
         return Err(pyo3::exceptions::PyValueError::new_err(
             "positions and depths must have the same length",
         ));
     }
+    if depths.iter().any(|&d| d < 0) {
+        return Err(pyo3::exceptions::PyValueError::new_err(
+            "depths must be non-negative",
+        ));
+    }
     let target_mask = target_mask.unwrap_or_default();
-    let cov: Vec<(i64, u32)> = positions.into_iter().zip(depths.into_iter()).collect();
-    let result = coverage::fraction_from_positions(
-        &cov,
-        (focal_start, focal_end),
-        (left_start, left_end),
-        (right_start, right_end),
-        min_cov,
-        &target_mask,
-    );
+    let result = py.allow_threads(|| {
+        coverage::fraction_from_positions(
+            positions.iter().zip(depths).map(|(&p, &d)| (p as i64, d as u32)),
+            (focal_start, focal_end),
+            (left_start, left_end),
+            (right_start, right_end),
+            min_cov,
+            &target_mask,
+        )
+    });
     let dict = PyDict::new_bound(py);
     dict.set_item("baseline_median", result.baseline_median)?;
     dict.set_item("focal_median", result.focal_median)?;
@@ -170,12 +802,92 @@ fn fraction_from_coverage<'py>(
     Ok(dict)
 }
 
+/// Exon-smoothed TcellExTRECT estimate (the native form of
+/// `tcell._estimate_upstream_from_coverage_df`).
+///
+/// `positions` (int64, strictly increasing) and `depths` (float64) are the
+/// coverage track; `full`, `focal`, the baselines and `exons` are inclusive
+/// `(start, end)` intervals.  With `reference_fasta` the log ratio is GC
+/// corrected.  Returns the same keys as the Python implementation, with
+/// `failure_reason` added when no estimate could be made.
+#[pyfunction]
+#[pyo3(signature = (positions, depths, chrom, full, focal, left_baseline, right_baseline, exons, min_cov=1.0, median_k=50, median_thresh=15.0, reference_fasta=None))]
+#[allow(clippy::too_many_arguments)]
+fn upstream_fraction_from_coverage<'py>(
+    py: Python<'py>,
+    positions: PyReadonlyArray1<'py, i64>,
+    depths: PyReadonlyArray1<'py, f64>,
+    chrom: &str,
+    full: (i64, i64),
+    focal: (i64, i64),
+    left_baseline: (i64, i64),
+    right_baseline: (i64, i64),
+    exons: Vec<(i64, i64)>,
+    min_cov: f64,
+    median_k: usize,
+    median_thresh: f64,
+    reference_fasta: Option<&str>,
+) -> PyResult<Bound<'py, PyDict>> {
+    let positions = positions.as_slice()?;
+    let depths = depths.as_slice()?;
+    if positions.len() != depths.len() {
+        return Err(pyo3::exceptions::PyValueError::new_err(
+            "positions and depths must have the same length",
+        ));
+    }
+    if positions.windows(2).any(|w| w[0] >= w[1]) {
+        return Err(pyo3::exceptions::PyValueError::new_err(
+            "positions must be strictly increasing",
+        ));
+    }
+    let params = coverage::UpstreamParams {
+        chrom,
+        full,
+        focal,
+        left_baseline,
+        right_baseline,
+        exons: &exons,
+        min_cov,
+        median_k,
+        median_thresh,
+        reference_fasta,
+    };
+    let result = py.allow_threads(|| coverage::upstream_fraction(positions, depths, &params));
+
+    let dict = PyDict::new_bound(py);
+    dict.set_item("baseline_median", result.tcell.baseline_median)?;
+    dict.set_item("focal_median", result.tcell.focal_median)?;
+    dict.set_item("log2_ratio", result.tcell.log2_ratio)?;
+    dict.set_item("tcell_fraction", result.tcell.tcell_fraction)?;
+    dict.set_item("tcell_fraction_lwr", result.tcell.tcell_fraction_lwr)?;
+    dict.set_item("tcell_fraction_upr", result.tcell.tcell_fraction_upr)?;
+    dict.set_item("focal_positions", result.tcell.focal_n)?;
+    dict.set_item("baseline_positions", result.tcell.baseline_n)?;
+    dict.set_item("qc_fit", result.qc_fit)?;
+    dict.set_item("coverage_mode", "upstream-exon-smoothed")?;
+    dict.set_item("gc_corrected", result.gc_corrected)?;
+    dict.set_item("exons_total", exons.len())?;
+    dict.set_item("exons_removed", result.exons_removed)?;
+    dict.set_item("exons_used", exons.len().saturating_sub(result.exons_removed))?;
+    if let Some(reason) = result.failure_reason {
+        dict.set_item("failure_reason", reason)?;
+    }
+    Ok(dict)
+}
+
 #[pymodule]
 fn _core(m: &Bound<'_, PyModule>) -> PyResult<()> {
     m.add("__version__", env!("CARGO_PKG_VERSION"))?;
+    m.add_class::<PyRealigner>()?;
+    m.add_class::<PyCohortRun>()?;
     m.add_function(wrap_pyfunction!(analyze_locus, m)?)?;
+    m.add_function(wrap_pyfunction!(prebuild_index, m)?)?;
+    m.add_function(wrap_pyfunction!(analyze_sample, m)?)?;
+    m.add_function(wrap_pyfunction!(analyze_cohort, m)?)?;
     m.add_function(wrap_pyfunction!(region_coverage, m)?)?;
+    m.add_function(wrap_pyfunction!(region_coverage_many, m)?)?;
     m.add_function(wrap_pyfunction!(tcell_fraction, m)?)?;
     m.add_function(wrap_pyfunction!(fraction_from_coverage, m)?)?;
+    m.add_function(wrap_pyfunction!(upstream_fraction_from_coverage, m)?)?;
     Ok(())
 }
@@ -0,0 +1,228 @@
+// Cheap, exact shortcuts around BWA realignment of soft-clipped reads.
+//
+// `SeedIndex` is the set of canonical 16-mers of a locus slice, read from the
+// very 2-bit sequence BWA indexed (so ambiguous bases carry the same random
+// substitutes BWA drew).  Every BWA-MEM seed is an exact match of at least
+// `min_seed_len` (19) bases, so a read whose two realigned halves could both
+// hit the locus must contain matching 16-mers on either side of the split,
+// at least `2 * 19 - 16` bases apart.  Reads failing that test could never
+// produce an SR call and are dropped before any alignment.
+//
+// `HitCache` memoizes alignments by sequence.  PCR/optical copies and
+// adapter read-through produce many identical full reads and halves, and an
+// alignment depends on nothing but the sequence (the primary-hit tie-break
+// is seeded from a hash of it), so a cached result is exactly what BWA would
+// return again.
+
+use crate::index_cache::Fnv1a;
+use crate::realign::Hit;
+
+/// k-mer length of the seed index; fits a canonical k-mer in a `u32`.
+const K: usize = 16;
+
+/// `mem_opt_init`'s `min_seed_len`.  We never change BWA's options.
+pub const BWA_MIN_SEED_LEN: usize = 19;
+
+/// Sorted canonical 16-mers of a locus slice.
+pub struct SeedIndex {
+    kmers: Vec<u32>,
+}
+
+impl SeedIndex {
+    /// Build from BWA's packed forward strand (`pac`, `l_pac` bases, four
+    /// 2-bit bases per byte, A=0 C=1 G=2 T=3, most significant first).
+    pub fn from_pac(pac: &[u8], l_pac: usize) -> Self {
+        let base = |i: usize| (pac[i >> 2] >> ((!i & 3) << 1)) & 3;
+        let mut kmers = Vec::with_capacity(l_pac.saturating_sub(K - 1));
+        let (mut fwd, mut rev) = (0_u32, 0_u32);
+        for i in 0..l_pac {
+            let c = base(i) as u32;
+            fwd = fwd << 2 | c;
+            rev = rev >> 2 | (3 - c) << (2 * (K - 1));
+            if i + 1 >= K {
+                kmers.push(fwd.min(rev));
+            }
+        }
+        kmers.sort_unstable();
+        kmers.dedup();
+        Self { kmers }
+    }
+
+    pub fn len(&self) -> usize {
+        self.kmers.len()
+    }
+
+    /// Query offsets of the first and last 16-mers of `read` (either
+    /// strand) present in the locus, if any.
+    fn seed_span(&self, read: &[u8]) -> Option<(usize, usize)> {
+        let mut span: Option<(usize, usize)> = None;
+        let (mut fwd, mut rev, mut run) = (0_u32, 0_u32, 0_usize);
+        for (i, &b) in read.iter().enumerate() {
+            let Some(c) = nt4(b) else {
+                run = 0;
+                continue;
+            };
+            fwd = fwd << 2 | c;
+            rev = rev >> 2 | (3 - c) << (2 * (K - 1));
+            run += 1;
+            if run < K || self.kmers.binary_search(&fwd.min(rev)).is_err() {
+                continue;
+            }
+            let pos = i + 1 - K;
+            span = Some(match span {
+                Some((first, _)) => (first, pos),
+                None => (pos, pos),
+            });
+        }
+        span
+    }
+
+    /// False only if no split of `read` can have a BWA seed in both halves,
+    /// i.e. the read cannot yield a split-read call against this locus.
+    pub fn may_split(&self, read: &[u8]) -> bool {
+        match self.seed_span(read) {
+            Some((first, last)) => last - first >= 2 * BWA_MIN_SEED_LEN - K,
+            None => false,
+        }
+    }
+}
+
+/// BWA's `nst_nt4_table` restricted to unambiguous bases.
+fn nt4(b: u8) -> Option<u32> {
+    match b {
+        b'A' | b'a' => Some(0),
+        b'C' | b'c' => Some(1),
+        b'G' | b'g' => Some(2),
+        b'T' | b't' => Some(3),
+        _ => None,
+    }
+}
+
+/// Direct-mapped, fixed-size memo of `Realigner::align` results.  A slot
+/// keeps the full sequence, so a hash collision is a miss, never a wrong
+/// answer.
+pub struct HitCache {
+    slots: Vec<Option<(Box<[u8]>, Vec<Hit>)>>,
+    pub hits: u64,
+    pub misses: u64,
+}
+
+impl HitCache {
+    pub fn new(slots: usize) -> Self {
+        Self {
+            slots: (0..slots.max(1)).map(|_| None).collect(),
+            hits: 0,
+            misses: 0,
+        }
+    }
+
+    fn slot(&self, seq: &[u8]) -> usize {
+        let mut h = Fnv1a::new();
+        h.write(seq);
+        (h.finish() % self.slots.len() as u64) as usize
+    }
+
+    pub fn get(&self, seq: &[u8]) -> Option<&[Hit]> {
+        match &self.slots[self.slot(seq)] {
+            Some((key, hits)) if key.as_ref() == seq => Some(hits),
+            _ => None,
+        }
+    }
+
+    pub fn insert(&mut self, seq: &[u8], hits: &[Hit]) {
+        let i = self.slot(seq);
+        self.slots[i] = Some((seq.into(), hits.to_vec()));
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn pack(seq: &[u8]) -> Vec<u8> {
+        let mut pac = vec![0_u8; seq.len().div_ceil(4)];
+        for (i, &b) in seq.iter().enumerate() {
+            pac[i >> 2] |= (nt4(b).unwrap() as u8) << ((!i & 3) << 1);
+        }
+        pac
+    }
+
+    fn revcomp(seq: &[u8]) -> Vec<u8> {
+        seq.iter()
+            .rev()
+            .map(|&b| match b {
+                b'A' => b'T',
+                b'C' => b'G',
+                b'G' => b'C',
+                _ => b'A',
+            })
+            .collect()
+    }
+
+    fn random_seq(n: usize, mut state: u64) -> Vec<u8> {
+        (0..n)
+            .map(|_| {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                b"ACGT"[(state & 3) as usize]
+            })
+            .collect()
+    }
+
+    #[test]
+    fn seed_index_screens_reads_by_seed_span() {
+        let reference = random_seq(5000, 0x9E37_79B9_7F4A_7C15);
+        let index = SeedIndex::from_pac(&pack(&reference), reference.len());
+        assert!(index.len() > 4900);
+
+        // A read from the locus, on either strand.
+        let read = &reference[1000..1100];
+        assert!(index.may_split(read));
+        assert!(index.may_split(&revcomp(read)));
+
+        // Foreign sequence has no seed at all.
+        let foreign = random_seq(100, 0x1234_5678_9abc_def1);
+        assert!(!index.may_split(&foreign));
+
+        // Chimera of foreign and locus sequence: a single seeded side is
+        // not enough once it is too short to hold two seeds.
+        let mut chimera = foreign[..70].to_vec();
+        chimera.extend_from_slice(&reference[3000..3030]);
+        assert!(!index.may_split(&chimera));
+
+        // Two locus segments far apart: both halves can seed.
+        let mut split = reference[200..250].to_vec();
+        split.extend_from_slice(&reference[4000..4050]);
+        assert!(index.may_split(&split));
+
+        // Ambiguous bases break k-mers but not the rest of the read.
+        let mut with_n = read.to_vec();
+        with_n[50] = b'N';
+        assert!(index.may_split(&with_n));
+    }
+
+    #[test]
+    fn hit_cache_is_keyed_by_full_sequence() {
+        let hit = Hit {
+            contig_name: "TRA".into(),
+            ref_start: 10,
+            ref_end: 60,
+            query_start: 0,
+            query_end: 50,
+            aligned_bases: 50,
+            as_score: 50,
+            strand: '+',
+            mapq: 60,
+        };
+        // One slot: every sequence collides.
+        let mut cache = HitCache::new(1);
+        assert!(cache.get(b"ACGT").is_none());
+        cache.insert(b"ACGT", std::slice::from_ref(&hit));
+        assert_eq!(cache.get(b"ACGT").unwrap()[0].ref_start, 10);
+        assert!(cache.get(b"ACGA").is_none());
+        cache.insert(b"ACGA", &[]);
+        assert!(cache.get(b"ACGT").is_none());
+        assert!(cache.get(b"ACGA").unwrap().is_empty());
+    }
+}
@@ -0,0 +1,60 @@
+// Opt-in per-stage accounting for a locus scan.
+//
+// A scan only carries a `Profile` when the caller asks for one; otherwise
+// every stage timer is a `Lap` over `None` and costs a branch, not a clock
+// read.  Stage times are wall time on the scanning thread: realignment
+// time includes waiting for its worker threads, and the BAM stages are
+// what htslib spent handing records to the scan.
+
+use std::time::Instant;
+
+#[derive(Clone, Debug, Default)]
+pub struct Profile {
+    /// Building or loading the locus BWA index, when the call did so.
+    pub index_seconds: f64,
+    /// Positioning on the locus window (for a single-locus scan, also
+    /// opening the BAM/CRAM and its index).
+    pub fetch_seconds: f64,
+    /// Reading and decoding records.
+    pub decode_seconds: f64,
+    pub soft_clip_seconds: f64,
+    /// Seed screen of clipped reads (`SeedIndex::may_split`).
+    pub prescreen_seconds: f64,
+    /// Full-read and half realignment, cache lookups included.
+    pub realign_seconds: f64,
+    /// Entropy checks of split halves.
+    pub entropy_seconds: f64,
+    /// Split-pair mate matching, eviction and entropy.
+    pub pair_scan_seconds: f64,
+    /// Records fed to the detector, duplicates and secondary alignments
+    /// included.
+    pub reads_scanned: u64,
+    /// Clipped reads that passed the seed screen and went to realignment.
+    pub reads_realigned: u64,
+    /// Sequences handed to BWA's `mem_align1_core`.
+    pub mem_align1_calls: u64,
+    /// Most reads held in the split-pair mate cache at once.
+    pub peak_pair_cache: u64,
+}
+
+/// Stage timer that reads the clock only when profiling.
+pub struct Lap(Option<Instant>);
+
+impl Lap {
+    pub fn start(on: bool) -> Self {
+        Self(on.then(Instant::now))
+    }
+
+    /// Seconds since `start` or the previous `split`; restarts the clock.
+    pub fn split(&mut self) -> f64 {
+        match &mut self.0 {
+            Some(t) => {
+                let now = Instant::now();
+                let secs = (now - *t).as_secs_f64();
+                *t = now;
+                secs
+            }
+            None => 0.0,
+        }
+    }
+}
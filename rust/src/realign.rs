@@ -1,6 +1,7 @@
 // Pure-FFI wrapper around BWA-MEM: extract a locus slice from a user-supplied
-// reference FASTA, build a per-locus BWA index in a tempdir, load it, and
-// expose a single-read alignment helper.
+// reference FASTA, build a per-locus BWA index (in a tempdir, or once into the
+// persistent `index_cache`), load it, and expose a single-read alignment
+// helper.
 //
 // The port of Splithunter.cpp relies on three BWA behaviours that minimap2 does
 // not faithfully reproduce for short reads: (1) the BWA seed-and-extend with
@@ -10,14 +11,17 @@
 // the same BWA index.  All three come from libbwa directly.
 
 use std::ffi::CString;
-use std::os::raw::c_char;
+use std::os::raw::{c_char, c_int, c_long, c_void};
 use std::path::{Path, PathBuf};
 use std::ptr;
+use std::sync::atomic::{AtomicU64, Ordering};
 
 use rust_htslib::faidx::Reader as FaiReader;
 use tempfile::TempDir;
 
 use crate::bwa_ffi::*;
+use crate::index_cache::{self, Fnv1a, IndexCache, Mapping};
+use crate::prescreen::SeedIndex;
 
 #[derive(Debug)]
 pub enum RealignError {
@@ -41,14 +45,24 @@ impl std::error::Error for RealignError {}
 
 /// A loaded per-locus BWA-MEM index.
 ///
-/// The backing tempdir is kept alive for the lifetime of the aligner so the
-/// `.bwt`/`.pac`/... files remain on disk until we're done with them.
+/// The backing storage is kept alive for the lifetime of the aligner: either
+/// the tempdir holding the `.bwt`/`.pac`/... files, or the read-only mapping
+/// of a cache entry that the index points into.
 pub struct Realigner {
     idx: *mut bwaidx_t,
     opt: *mut mem_opt_t,
     contig_name: String,
+    chrom: String,
     contig_offset: i64,
-    _tmp: TempDir,
+    contig_end: i64,
+    index_path: Option<PathBuf>,
+    seeds: SeedIndex,
+    _backing: Backing,
+}
+
+enum Backing {
+    Scratch(#[allow(dead_code)] TempDir),
+    Mapped(#[allow(dead_code)] Mapping),
 }
 
 // BWA's index and option structs are read-only after construction and safe to
@@ -66,6 +80,7 @@ impl Drop for Realigner {
                 libc::free(self.opt as *mut libc::c_void);
             }
         }
+        // `_backing` (tempdir or mapping) drops after the index is gone.
     }
 }
 
@@ -92,17 +107,7 @@ impl Realigner {
         end: i64,
         locus_name: &str,
     ) -> Result<Self, RealignError> {
-        let reader = FaiReader::from_path(reference_fasta)
-            .map_err(|e| RealignError::Faidx(format!("open {reference_fasta}: {e}")))?;
-        // fetch_seq_string takes inclusive end.
-        let seq = reader
-            .fetch_seq_string(chrom, start as usize, (end - 1) as usize)
-            .map_err(|e| RealignError::Faidx(format!("fetch {chrom}:{start}-{end}: {e}")))?;
-        if seq.is_empty() {
-            return Err(RealignError::Faidx(format!(
-                "empty slice for {chrom}:{start}-{end}"
-            )));
-        }
+        let seq = fetch_slice(reference_fasta, chrom, start, end)?;
 
         let tmp = tempfile::Builder::new()
             .prefix("splithunter-bwa-")
@@ -115,42 +120,159 @@ impl Realigner {
         let prefix_path: PathBuf = fasta_path.clone();
         build_index(&fasta_path, &prefix_path)?;
         let idx = load_index(&prefix_path)?;
+        Self::with_index(idx, locus_name, chrom, start, end, None, Backing::Scratch(tmp))
+    }
+
+    /// Like `from_reference`, but go through the persistent index cache: the
+    /// index for this slice is built on first use and every later call (in
+    /// this or any other process) maps the stored image read-only.
+    pub fn from_cache(
+        cache: &IndexCache,
+        reference_fasta: &str,
+        chrom: &str,
+        start: i64,
+        end: i64,
+        locus_name: &str,
+    ) -> Result<Self, RealignError> {
+        let seq = fetch_slice(reference_fasta, chrom, start, end)?;
+        let entry = cache.ensure(seq.as_bytes(), chrom, start, end, locus_name)?;
+        let (idx, mapping) = index_cache::load_mapped(&entry)?;
+        Self::with_index(idx, locus_name, chrom, start, end, Some(entry), Backing::Mapped(mapping))
+    }
+
+    fn with_index(
+        idx: *mut bwaidx_t,
+        locus_name: &str,
+        chrom: &str,
+        start: i64,
+        end: i64,
+        index_path: Option<PathBuf>,
+        backing: Backing,
+    ) -> Result<Self, RealignError> {
         let opt = unsafe { mem_opt_init() };
         if opt.is_null() {
             unsafe { bwa_idx_destroy(idx) };
             return Err(RealignError::LoadIndex("mem_opt_init() returned null".into()));
         }
 
+        let seeds = unsafe {
+            let l_pac = (*(*idx).bns).l_pac as usize;
+            SeedIndex::from_pac(std::slice::from_raw_parts((*idx).pac, l_pac.div_ceil(4)), l_pac)
+        };
         Ok(Self {
             idx,
             opt,
             contig_name: locus_name.to_string(),
+            chrom: chrom.to_string(),
             contig_offset: start,
-            _tmp: tmp,
+            contig_end: end,
+            index_path,
+            seeds,
+            _backing: backing,
         })
     }
 
+    /// Name the aligned slice is reported under (the locus name).
+    pub fn contig_name(&self) -> &str {
+        &self.contig_name
+    }
+
+    /// Reference chromosome the slice was cut from.
+    pub fn chrom(&self) -> &str {
+        &self.chrom
+    }
+
+    /// Reference window `[start, end)` the index was built over.
+    pub fn span(&self) -> (i64, i64) {
+        (self.contig_offset, self.contig_end)
+    }
+
+    /// Whether this index was built for locus `name` at `chrom:start-end`.
+    pub fn covers(&self, name: &str, chrom: &str, start: i64, end: i64) -> bool {
+        self.contig_name == name && self.chrom == chrom && self.span() == (start, end)
+    }
+
+    /// Cache entry backing this index, if it was loaded through the cache.
+    pub fn index_path(&self) -> Option<&Path> {
+        self.index_path.as_deref()
+    }
+
+    /// k-mer screen over the indexed slice (see `prescreen.rs`).
+    pub fn seeds(&self) -> &SeedIndex {
+        &self.seeds
+    }
+
     /// Align a short read against the locus index.  Returns hits sorted by
     /// alignment score descending (BWA's default).
     pub fn align(&self, read: &[u8]) -> Vec<Hit> {
-        if read.is_empty() || self.idx.is_null() {
-            return Vec::new();
+        self.align_with_buf(read, ptr::null_mut(), &AtomicU64::new(0))
+    }
+
+    /// Align a batch of reads on `threads` worker threads (BWA's `kt_for`,
+    /// one seeding buffer per thread as in `mem_process_seqs`).  `out[i]`
+    /// holds exactly what `align(reads[i])` returns, whatever the thread
+    /// count or scheduling.
+    pub fn align_batch(&self, reads: &[&[u8]], threads: usize) -> Vec<Vec<Hit>> {
+        self.align_batch_counted(reads, threads).0
+    }
+
+    /// `align_batch`, plus how many of `reads` actually went to BWA's
+    /// `mem_align1_core` (empty reads and reads with a NUL byte do not).
+    pub fn align_batch_counted(&self, reads: &[&[u8]], threads: usize) -> (Vec<Vec<Hit>>, u64) {
+        let calls = AtomicU64::new(0);
+        let mut out: Vec<Vec<Hit>> = Vec::with_capacity(reads.len());
+        out.resize_with(reads.len(), Vec::new);
+        if reads.is_empty() {
+            return (out, 0);
+        }
+        let threads = threads.clamp(1, reads.len());
+        let bufs: Vec<AuxBuf> = (0..threads).map(|_| AuxBuf::new()).collect();
+        if threads == 1 {
+            for (slot, read) in out.iter_mut().zip(reads) {
+                *slot = self.align_with_buf(read, bufs[0].0, &calls);
+            }
+            return (out, calls.into_inner());
         }
-        let idx = unsafe { &*self.idx };
 
-        let c_seq = match CString::new(read) {
-            Ok(v) => v,
-            Err(_) => return Vec::new(),
+        let mut job = BatchJob {
+            realigner: self,
+            reads,
+            out: out.as_mut_ptr(),
+            bufs: &bufs,
+            calls: &calls,
         };
+        unsafe {
+            kt_for(
+                threads as c_int,
+                batch_worker,
+                &mut job as *mut BatchJob as *mut c_void,
+                reads.len() as c_long,
+            );
+        }
+        (out, calls.into_inner())
+    }
+
+    fn align_with_buf(&self, read: &[u8], buf: *mut c_void, calls: &AtomicU64) -> Vec<Hit> {
+        // Interior NULs would have truncated the C string BWA sees.
+        if read.is_empty() || self.idx.is_null() || read.contains(&0) {
+            return Vec::new();
+        }
+        let idx = unsafe { &*self.idx };
+        calls.fetch_add(1, Ordering::Relaxed);
 
+        // mem_align1_core converts the query to 2-bit codes in place, which
+        // mem_reg2aln also accepts, so one owned copy serves both calls.
+        let mut seq: Vec<u8> = read.to_vec();
+        let l_seq = seq.len() as c_int;
         let regs = unsafe {
-            mem_align1(
+            mem_align1_core(
                 self.opt,
                 idx.bwt,
                 idx.bns,
                 idx.pac,
-                read.len() as i32,
-                c_seq.as_ptr(),
+                l_seq,
+                seq.as_mut_ptr() as *mut c_char,
+                buf,
             )
         };
         if regs.a.is_null() || regs.n == 0 {
@@ -159,6 +281,10 @@ impl Realigner {
             }
             return Vec::new();
         }
+        // Seed the primary tie-break from the read itself rather than
+        // mem_align1's lrand48(), so a read gets the same primary no matter
+        // which thread aligns it or how many reads came before.
+        unsafe { mem_mark_primary_se(self.opt, regs.n as c_int, regs.a, read_id(read)) };
 
         let mut hits = Vec::with_capacity(regs.n as usize);
         for i in 0..regs.n {
@@ -172,8 +298,8 @@ impl Realigner {
                     self.opt,
                     idx.bns,
                     idx.pac,
-                    read.len() as i32,
-                    c_seq.as_ptr(),
+                    l_seq,
+                    seq.as_ptr() as *const c_char,
                     &reg as *const _,
                 )
             };
@@ -204,7 +330,69 @@ impl Realigner {
     }
 }
 
-fn build_index(fa: &Path, prefix: &Path) -> Result<(), RealignError> {
+/// Seeding scratch buffer owned by one batch worker thread.
+struct AuxBuf(*mut c_void);
+
+impl AuxBuf {
+    fn new() -> Self {
+        Self(unsafe { smem_aux_init() })
+    }
+}
+
+impl Drop for AuxBuf {
+    fn drop(&mut self) {
+        if !self.0.is_null() {
+            unsafe { smem_aux_destroy(self.0) };
+        }
+    }
+}
+
+struct BatchJob<'a> {
+    realigner: &'a Realigner,
+    reads: &'a [&'a [u8]],
+    out: *mut Vec<Hit>,
+    bufs: &'a [AuxBuf],
+    calls: &'a AtomicU64,
+}
+
+/// `kt_for` callback.  Each index is visited exactly once, so the writes to
+/// `out[i]` never alias, and each `tid` owns `bufs[tid]` exclusively.
+extern "C" fn batch_worker(data: *mut c_void, i: c_long, tid: c_int) {
+    let job = unsafe { &*(data as *const BatchJob) };
+    let i = i as usize;
+    let hits = job.realigner.align_with_buf(job.reads[i], job.bufs[tid as usize].0, job.calls);
+    unsafe { *job.out.add(i) = hits };
+}
+
+/// Stable per-sequence id for `mem_mark_primary_se`.
+fn read_id(read: &[u8]) -> i64 {
+    let mut h = Fnv1a::new();
+    h.write(read);
+    (h.finish() >> 1) as i64
+}
+
+/// Fetch `chrom:start-end` (0-based, half-open) from an FAI-indexed FASTA.
+pub(crate) fn fetch_slice(
+    reference_fasta: &str,
+    chrom: &str,
+    start: i64,
+    end: i64,
+) -> Result<String, RealignError> {
+    let reader = FaiReader::from_path(reference_fasta)
+        .map_err(|e| RealignError::Faidx(format!("open {reference_fasta}: {e}")))?;
+    // fetch_seq_string takes inclusive end.
+    let seq = reader
+        .fetch_seq_string(chrom, start as usize, (end - 1) as usize)
+        .map_err(|e| RealignError::Faidx(format!("fetch {chrom}:{start}-{end}: {e}")))?;
+    if seq.is_empty() {
+        return Err(RealignError::Faidx(format!(
+            "empty slice for {chrom}:{start}-{end}"
+        )));
+    }
+    Ok(seq)
+}
+
+pub(crate) fn build_index(fa: &Path, prefix: &Path) -> Result<(), RealignError> {
     let fa_c = path_to_cstring(fa)?;
     let prefix_c = path_to_cstring(prefix)?;
     let rc = unsafe {
@@ -221,7 +409,7 @@ fn build_index(fa: &Path, prefix: &Path) -> Result<(), RealignError> {
     Ok(())
 }
 
-fn load_index(prefix: &Path) -> Result<*mut bwaidx_t, RealignError> {
+pub(crate) fn load_index(prefix: &Path) -> Result<*mut bwaidx_t, RealignError> {
     let prefix_c = path_to_cstring(prefix)?;
     let idx = unsafe { bwa_idx_load_from_disk(prefix_c.as_ptr(), BWA_IDX_ALL) };
     if idx.is_null() {
@@ -256,18 +444,13 @@ fn free_aln(aln: &mem_aln_t) {
 }
 
 #[cfg(test)]
-mod tests {
+pub(crate) mod tests {
     use super::*;
 
-    /// End-to-end sanity check: build a BWA-MEM index from a synthetic 5 kb
-    /// reference, align a read drawn from position 1000, and verify the
-    /// realigner returns a hit whose reference coordinate lands in the
-    /// correct window.  This proves the entire vendored-BWA + FFI chain is
-    /// wired up correctly on the host architecture (SSE2/NEON included).
-    #[test]
-    fn realigner_roundtrip_on_synthetic_reference() {
-        let dir = tempfile::tempdir().unwrap();
-        let fa = dir.path().join("toy.fa");
+    /// Write a deterministic high-entropy 5 kb reference plus its FAI into
+    /// `dir` and return (fasta path, sequence).
+    pub(crate) fn toy_reference(dir: &Path) -> (PathBuf, String) {
+        let fa = dir.join("toy.fa");
         // Deterministic high-entropy sequence via xorshift — short cycles
         // in a toy reference would give BWA equally-scoring hits and mask
         // position correctness.
@@ -297,6 +480,18 @@ mod tests {
             let content = format!("chr_toy\t{}\t{}\t{}\t{}\n", seq.len(), header_len, seq.len(), seq.len() + 1);
             std::fs::write(fa.with_extension("fa.fai"), content).unwrap();
         }
+        (fa, seq)
+    }
+
+    /// End-to-end sanity check: build a BWA-MEM index from a synthetic 5 kb
+    /// reference, align a read drawn from position 1000, and verify the
+    /// realigner returns a hit whose reference coordinate lands in the
+    /// correct window.  This proves the entire vendored-BWA + FFI chain is
+    /// wired up correctly on the host architecture (SSE2/NEON included).
+    #[test]
+    fn realigner_roundtrip_on_synthetic_reference() {
+        let dir = tempfile::tempdir().unwrap();
+        let (fa, seq) = toy_reference(dir.path());
 
         let r = Realigner::from_reference(
             fa.to_str().unwrap(),
@@ -320,4 +515,113 @@ mod tests {
         assert!(h.aligned_bases >= 95, "query span {}", h.aligned_bases);
         assert_eq!(h.strand, '+');
     }
+
+    /// The mapped cache entry must align exactly like a freshly built index,
+    /// and a second load must reuse the entry rather than rebuild it.
+    #[test]
+    fn cached_index_matches_fresh_build() {
+        let dir = tempfile::tempdir().unwrap();
+        let (fa, seq) = toy_reference(dir.path());
+        let fa = fa.to_str().unwrap();
+        let cache_dir = dir.path().join("cache");
+        let cache = IndexCache::open(cache_dir.to_str()).unwrap();
+
+        let fresh = Realigner::from_reference(fa, "chr_toy", 0, 5000, "chr_toy").unwrap();
+        let first = Realigner::from_cache(&cache, fa, "chr_toy", 0, 5000, "chr_toy").unwrap();
+        let entry = first.index_path().unwrap().to_path_buf();
+        let mtime = std::fs::metadata(&entry).unwrap().modified().unwrap();
+        let second = Realigner::from_cache(&cache, fa, "chr_toy", 0, 5000, "chr_toy").unwrap();
+        assert_eq!(second.index_path(), Some(entry.as_path()));
+        assert_eq!(std::fs::metadata(&entry).unwrap().modified().unwrap(), mtime);
+
+        let read = &seq.as_bytes()[2000..2100];
+        let want = fresh.align(read);
+        for r in [&first, &second] {
+            let got = r.align(read);
+            assert_eq!(got.len(), want.len());
+            for (g, w) in got.iter().zip(want.iter()) {
+                assert_eq!((g.ref_start, g.ref_end, g.as_score), (w.ref_start, w.ref_end, w.as_score));
+            }
+        }
+    }
+
+    /// A truncated entry must be rebuilt, not handed to `bwa_mem2idx`.
+    #[test]
+    fn truncated_cache_entry_is_rebuilt() {
+        let dir = tempfile::tempdir().unwrap();
+        let (fa, seq) = toy_reference(dir.path());
+        let fa = fa.to_str().unwrap();
+        let cache = IndexCache::open(dir.path().join("cache").to_str()).unwrap();
+
+        let first = Realigner::from_cache(&cache, fa, "chr_toy", 0, 5000, "chr_toy").unwrap();
+        let entry = first.index_path().unwrap().to_path_buf();
+        let full_len = std::fs::metadata(&entry).unwrap().len();
+        drop(first);
+
+        let f = std::fs::OpenOptions::new().write(true).open(&entry).unwrap();
+        f.set_len(full_len / 2).unwrap();
+        drop(f);
+        assert!(index_cache::load_mapped(&entry).is_err());
+
+        let rebuilt = Realigner::from_cache(&cache, fa, "chr_toy", 0, 5000, "chr_toy").unwrap();
+        assert_eq!(rebuilt.index_path(), Some(entry.as_path()));
+        assert_eq!(std::fs::metadata(&entry).unwrap().len(), full_len);
+        assert!(!rebuilt.align(&seq.as_bytes()[2000..2100]).is_empty());
+    }
+
+    /// Batched, multi-threaded realignment must reproduce the serial path
+    /// read-for-read, in input order.
+    #[test]
+    fn align_batch_matches_serial_align() {
+        let dir = tempfile::tempdir().unwrap();
+        let (fa, seq) = toy_reference(dir.path());
+        let r = Realigner::from_reference(fa.to_str().unwrap(), "chr_toy", 0, 5000, "chr_toy")
+            .unwrap();
+
+        let bytes = seq.as_bytes();
+        // Plain reads, chimeric reads (two distant halves) and a read that
+        // should not align at all.
+        let mut reads: Vec<Vec<u8>> = (0..40)
+            .map(|k| bytes[k * 100..k * 100 + 100].to_vec())
+            .collect();
+        for k in 0..20 {
+            let mut chimera = bytes[k * 50..k * 50 + 60].to_vec();
+            chimera.extend_from_slice(&bytes[4000 - k * 50..4000 - k * 50 + 60]);
+            reads.push(chimera);
+        }
+        reads.push(vec![b'A'; 100]);
+        let queries: Vec<&[u8]> = reads.iter().map(|v| v.as_slice()).collect();
+
+        let serial: Vec<Vec<Hit>> = queries.iter().map(|q| r.align(q)).collect();
+        for threads in [1, 3, 8] {
+            let batched = r.align_batch(&queries, threads);
+            assert_eq!(batched.len(), serial.len());
+            for (b, s) in batched.iter().zip(serial.iter()) {
+                let key = |h: &Hit| (h.ref_start, h.ref_end, h.query_start, h.query_end, h.as_score, h.strand);
+                assert_eq!(b.iter().map(key).collect::<Vec<_>>(), s.iter().map(key).collect::<Vec<_>>());
+            }
+        }
+        assert!(r.align_batch(&[], 4).is_empty());
+    }
+
+    /// Only reads BWA can see are counted as `mem_align1_core` calls.
+    #[test]
+    fn align_batch_counts_bwa_calls() {
+        let dir = tempfile::tempdir().unwrap();
+        let (fa, seq) = toy_reference(dir.path());
+        let r = Realigner::from_reference(fa.to_str().unwrap(), "chr_toy", 0, 5000, "chr_toy")
+            .unwrap();
+
+        let bytes = seq.as_bytes();
+        let mut with_nul = bytes[200..300].to_vec();
+        with_nul[50] = 0;
+        let queries: Vec<&[u8]> =
+            vec![&bytes[0..100], b"", &bytes[1000..1100], &with_nul, &bytes[0..100]];
+        for threads in [1, 3] {
+            let (hits, calls) = r.align_batch_counted(&queries, threads);
+            assert_eq!(calls, 3);
+            assert!(hits[1].is_empty() && hits[3].is_empty());
+        }
+        assert_eq!(r.align_batch_counted(&[], 2).1, 0);
+    }
 }
@@ -0,0 +1,155 @@
+// Fused single-pass scan of one sample over several loci.
+//
+// `split::analyze` and `coverage::region_coverage` each open the BAM and
+// walk the locus again; on CRAM or remote BAMs every reopen repeats index
+// loading, header parsing and block decompression.  Here the file is opened
+// once, each locus window is fetched once, and every record in that stream
+// feeds both the SR/SP detector and (optionally) the depth accumulator.
+// Every window is planned before the first fetch, so with prefetch on the
+// reads for later loci are in flight while earlier ones decode.
+
+use std::time::Instant;
+
+use rust_htslib::bam::record::Record;
+use rust_htslib::errors::Error as HtslibError;
+
+use crate::bamio::{BamSource, IoConfig, IoStats};
+use crate::coverage::{DepthAccumulator, DepthTrack};
+use crate::realign::Realigner;
+use crate::split::{self, LocusScan, Summary};
+
+#[derive(Clone)]
+pub struct LocusSpec {
+    pub name: String,
+    pub chrom: String,
+    pub start: i64,
+    pub end: i64,
+    /// Window to accumulate a depth track over, if any.  May extend past
+    /// the locus (e.g. TcellExTRECT baselines); the fetch is widened to
+    /// cover both, and only records overlapping the locus reach SR/SP.
+    pub coverage: Option<(i64, i64)>,
+}
+
+pub struct LocusOutput {
+    pub summary: Summary,
+    pub coverage: Option<DepthTrack>,
+    /// I/O spent on this locus (the first one also carries opening the file).
+    pub io: IoStats,
+}
+
+/// Detection parameters shared by every locus of a scan.
+#[derive(Clone, Copy)]
+pub struct ScanParams {
+    pub pad: i64,
+    pub indel: i64,
+    pub min_entropy: f64,
+    pub min_mapq: u8,
+    /// Realignment threads per locus.
+    pub threads: usize,
+    pub io: IoConfig,
+    /// Collect per-stage timings into each `Summary::profile`.
+    pub profile: bool,
+}
+
+pub fn analyze_sample(
+    bam_path: &str,
+    loci: &[LocusSpec],
+    realigners: &[&Realigner],
+    params: ScanParams,
+) -> Result<Vec<LocusOutput>, HtslibError> {
+    let mut reader = BamSource::open(bam_path, params.io)?;
+    let header_names = split::header_names(reader.header());
+    let windows: Vec<(u32, i64, i64)> = loci
+        .iter()
+        .filter_map(|locus| {
+            let tid = reader.header().tid(locus.chrom.as_bytes())?;
+            let (start, end) = fetch_window(locus);
+            Some((tid, start, end))
+        })
+        .collect();
+    reader.plan(&windows);
+    let mut out = Vec::with_capacity(loci.len());
+    let mut rec = Record::new();
+
+    for (locus, realigner) in loci.iter().zip(realigners.iter()) {
+        out.push(scan_locus(&mut reader, &header_names, locus, realigner, params, &mut rec)?);
+    }
+    Ok(out)
+}
+
+/// Fetch one locus (widened to its coverage window) from an open reader
+/// and run every consumer over that record stream.  `rec` is scratch space
+/// reused across calls.
+pub fn scan_locus(
+    reader: &mut BamSource,
+    header_names: &[String],
+    locus: &LocusSpec,
+    realigner: &Realigner,
+    params: ScanParams,
+    rec: &mut Record,
+) -> Result<LocusOutput, HtslibError> {
+    let fetched = Instant::now();
+    let tid = reader
+        .header()
+        .tid(locus.chrom.as_bytes())
+        .ok_or_else(|| HtslibError::Fetch)?;
+    let (fetch_start, fetch_end) = fetch_window(locus);
+    let widened = (fetch_start, fetch_end) != (locus.start, locus.end);
+    reader.fetch(tid, fetch_start, fetch_end)?;
+    let fetch_seconds = fetched.elapsed().as_secs_f64();
+
+    let mut scan = LocusScan::new(
+        &locus.chrom,
+        locus.end,
+        params.pad,
+        params.indel,
+        params.min_entropy,
+        realigner,
+        params.threads,
+    );
+    if params.profile {
+        scan = scan.profiled();
+    }
+    let mut depth = locus
+        .coverage
+        .map(|(s, e)| DepthAccumulator::new(s, e, params.min_mapq));
+    while let Some(result) = reader.read(rec) {
+        result?;
+        if let Some(depth) = depth.as_mut() {
+            depth.push(rec);
+        }
+        if !widened || overlaps(rec, locus.start, locus.end) {
+            scan.push(rec, header_names);
+        }
+    }
+    let mut summary = scan.finish();
+    let io = reader.take_stats();
+    if let Some(p) = summary.profile.as_mut() {
+        p.fetch_seconds = fetch_seconds;
+        p.decode_seconds = io.decode_seconds;
+    }
+    Ok(LocusOutput {
+        summary,
+        coverage: depth.map(DepthAccumulator::finish),
+        io,
+    })
+}
+
+/// The locus widened to its coverage window.
+pub fn fetch_window(locus: &LocusSpec) -> (i64, i64) {
+    match locus.coverage {
+        Some((s, e)) => (s.min(locus.start), e.max(locus.end)),
+        None => (locus.start, locus.end),
+    }
+}
+
+/// htslib's region-overlap test (`bam_endpos` treats a record without
+/// reference-consuming operations as covering one base).
+fn overlaps(rec: &Record, start: i64, end: i64) -> bool {
+    let pos = rec.pos();
+    let mut rec_end = rec.cigar().end_pos();
+    if rec.is_unmapped() || rec_end <= pos {
+        rec_end = pos + 1;
+    }
+    pos < end && rec_end > start
+}
@@ -4,17 +4,41 @@
 // carries a significant soft-clip we re-align the full read against an
 // in-memory BWA-MEM index of the locus, split at the query clip junction,
 // re-align the two halves independently, then apply the original
-// AS / distance / entropy filters.  Split pairs are detected by caching
-// paired reads in the target region and checking inter-mate distance.
+// AS / distance / entropy filters.  Split pairs are detected by pairing up
+// mostly-aligned mates in the target region and checking their distance.
+//
+// Realignment is batched: clipped candidates are collected in scan order
+// into chunks of `SR_CHUNK` reads, full reads are aligned in parallel, and
+// only reads whose full-read hit passes the clip test get their two halves
+// aligned in a second parallel pass.  Verdicts are then applied in scan
+// order, so SR-DETAILS is identical for any thread count.
+//
+// BWA work is trimmed without changing any call (see `prescreen.rs`): reads
+// that cannot seed on both sides of a split never reach BWA, the entropy
+// condition is checked before the halves are aligned, and repeated
+// sequences are served from a per-locus alignment cache.
+//
+// Split pairs are found in a single streaming pass (see `PairScan`): a read
+// is only held until its mate arrives or the scan moves past the mate's
+// position, so memory tracks the insert-size span rather than the locus.
+//
+// With profiling on (`LocusScan::profiled`), each stage of `push` and of
+// realignment is timed into a `Profile` returned with the summary.
 
-use std::collections::HashMap;
-use std::str;
+use std::cmp::Reverse;
+use std::collections::{BinaryHeap, HashMap};
+use std::mem::size_of;
+use std::time::Instant;
 
 use rust_htslib::bam::record::{Cigar, Record};
-use rust_htslib::bam::{IndexedReader, Read};
+use rust_htslib::bam::HeaderView;
 use rust_htslib::errors::Error as HtslibError;
 
+use crate::bamio::{BamSource, IoConfig};
 use crate::entropy::trinucleotide_entropy;
+use crate::index_cache::Fnv1a;
+use crate::prescreen::HitCache;
+use crate::profile::{Lap, Profile};
 use crate::realign::{Hit, Realigner};
 
 #[derive(Default)]
@@ -25,6 +49,20 @@ pub struct Summary {
     pub sp_total: u64,
     pub sp_signal: u64,
     pub sp_details: String,
+    /// Clipped reads dropped by the seed screen without any alignment.
+    pub sr_prescreened: u64,
+    /// Splits dropped on entropy before their halves were aligned.
+    pub sr_low_complexity: u64,
+    /// Alignments served from the sequence cache.
+    pub sr_cache_hits: u64,
+    /// Alignments actually run through BWA.
+    pub sr_cache_misses: u64,
+    /// Most reads held at once while waiting for their mates.
+    pub sp_peak_pending: u64,
+    /// Heap footprint of the split-pair state at its largest, in bytes.
+    pub sp_peak_bytes: u64,
+    /// Stage timings and counters, only when the scan was profiled.
+    pub profile: Option<Profile>,
 }
 
 impl Summary {
@@ -36,13 +74,12 @@ impl Summary {
     }
 }
 
-struct PairedEndpoint {
-    chrom: String,
-    start: i64,
-    end: i64,
-    strand: char,
-    seq: Vec<u8>,
-}
+/// Clipped reads realigned per batch.  Large enough to keep every worker
+/// busy, small enough that a chunk of 150 bp reads stays a few MB.
+const SR_CHUNK: usize = 4096;
+
+/// Slots in the per-locus alignment cache (full reads and halves alike).
+const HIT_CACHE_SLOTS: usize = 1 << 14;
 
 pub fn analyze(
     bam_path: &str,
@@ -53,58 +90,116 @@ pub fn analyze(
     indel: i64,
     min_entropy: f64,
     realigner: &Realigner,
+    threads: usize,
+    io: IoConfig,
+    profile: bool,
 ) -> Result<Summary, HtslibError> {
-    let mut reader = IndexedReader::from_path(bam_path)?;
+    let opened = Instant::now();
+    let mut reader = BamSource::open(bam_path, io)?;
     let tid = reader
         .header()
         .tid(chrom.as_bytes())
         .ok_or_else(|| HtslibError::Fetch)?;
-    let header_names: Vec<String> = (0..reader.header().target_count())
-        .map(|i| String::from_utf8_lossy(reader.header().tid2name(i)).into_owned())
-        .collect();
-    reader.fetch((tid, start as u64, end as u64))?;
+    let header_names = header_names(reader.header());
+    reader.fetch(tid, start, end)?;
+    let fetch_seconds = opened.elapsed().as_secs_f64();
 
-    let mut summary = Summary::default();
-    let mut pair_cache: HashMap<String, Vec<PairedEndpoint>> = HashMap::new();
+    let mut scan = LocusScan::new(chrom, end, pad, indel, min_entropy, realigner, threads);
+    if profile {
+        scan = scan.profiled();
+    }
     let mut rec = Record::new();
-
     while let Some(result) = reader.read(&mut rec) {
         result?;
+        scan.push(&rec, &header_names);
+    }
+    let mut summary = scan.finish();
+    if let Some(p) = summary.profile.as_mut() {
+        p.fetch_seconds = fetch_seconds;
+        p.decode_seconds = reader.take_stats().decode_seconds;
+    }
+    Ok(summary)
+}
+
+/// Contig names of a BAM header, indexed by tid.
+pub fn header_names(header: &HeaderView) -> Vec<String> {
+    (0..header.target_count())
+        .map(|i| String::from_utf8_lossy(header.tid2name(i)).into_owned())
+        .collect()
+}
+
+/// Incremental SR/SP detector for one locus.  Feed it every record fetched
+/// from the locus window with `push`, in file order, then call `finish`.
+/// This lets one record stream drive several consumers (see `sample.rs`).
+pub struct LocusScan<'a> {
+    pad: i64,
+    indel: i64,
+    min_entropy: f64,
+    realigner: &'a Realigner,
+    threads: usize,
+    summary: Summary,
+    pairs: PairScan,
+    sr_batch: Vec<Vec<u8>>,
+    cache: HitCache,
+    profile: Option<Profile>,
+}
+
+impl<'a> LocusScan<'a> {
+    /// `end` is the end of the fetched locus window: mates starting at or
+    /// beyond it never reach `push`, so reads pointing there are not held.
+    pub fn new(
+        chrom: &str,
+        end: i64,
+        pad: i64,
+        indel: i64,
+        min_entropy: f64,
+        realigner: &'a Realigner,
+        threads: usize,
+    ) -> Self {
+        Self {
+            pad,
+            indel,
+            min_entropy,
+            realigner,
+            threads,
+            summary: Summary::default(),
+            pairs: PairScan::new(chrom, end, indel, min_entropy),
+            sr_batch: Vec::with_capacity(SR_CHUNK),
+            cache: HitCache::new(HIT_CACHE_SLOTS),
+            profile: None,
+        }
+    }
+
+    /// Time each stage and count the work done; `finish` returns the
+    /// figures in `Summary::profile`.  Results are unchanged.
+    pub fn profiled(mut self) -> Self {
+        self.profile = Some(Profile::default());
+        self
+    }
+
+    pub fn push(&mut self, rec: &Record, header_names: &[String]) {
+        if let Some(p) = self.profile.as_mut() {
+            p.reads_scanned += 1;
+        }
         if rec.is_duplicate() || rec.is_secondary() || rec.is_supplementary() {
-            continue;
+            return;
         }
+        let pad = self.pad;
+        let mut lap = Lap::start(self.profile.is_some());
 
-        summary.sr_total += 1;
+        self.summary.sr_total += 1;
 
-        let qname = str::from_utf8(rec.qname()).unwrap_or("").to_string();
         let read_len = rec.seq_len() as i64;
-        let clip = soft_clip_len(&rec);
+        let clip = soft_clip_len(rec);
+        if let Some(p) = self.profile.as_mut() {
+            p.soft_clip_seconds += lap.split();
+        }
 
-        // ---- SP cache: paired read that is "mostly aligned" ---------------
-        //
-        // Matches the C++ condition readScore >= readLen - PAD, where score
-        // is the number of aligned bases.  Aligned == readLen - soft_clip.
-        let aligned_primary = read_len - clip;
-        if rec.is_paired()
-            && !rec.is_unmapped()
-            && !rec.is_mate_unmapped()
-            && aligned_primary >= read_len - pad
-        {
-            let start_ref = rec.pos();
-            let end_ref = rec.cigar().end_pos();
-            let strand = if rec.is_reverse() { '-' } else { '+' };
-            let seq = rec.seq().as_bytes();
-            let chrom_name = header_names
-                .get(rec.tid() as usize)
-                .cloned()
-                .unwrap_or_else(|| chrom.to_string());
-            pair_cache.entry(qname.clone()).or_default().push(PairedEndpoint {
-                chrom: chrom_name,
-                start: start_ref,
-                end: end_ref,
-                strand,
-                seq,
-            });
+        if sp_candidate(rec, read_len, clip, pad) {
+            self.pairs.push(rec, header_names, &mut self.summary);
+            if let Some(p) = self.profile.as_mut() {
+                p.pair_scan_seconds += lap.split();
+            }
         }
 
         // ---- SR detection -------------------------------------------------
@@ -114,41 +209,255 @@ pub fn analyze(
         // untrimmed reads (clip too small) and reads that are almost
         // entirely clipped (nothing to align against the locus).
         if clip < pad || clip > read_len - pad {
-            continue;
+            return;
+        }
+        let seq = rec.seq().as_bytes();
+        let may_split = self.realigner.seeds().may_split(&seq);
+        if let Some(p) = self.profile.as_mut() {
+            p.prescreen_seconds += lap.split();
+        }
+        if !may_split {
+            self.summary.sr_prescreened += 1;
+            return;
         }
+        self.sr_batch.push(seq);
+        if self.sr_batch.len() == SR_CHUNK {
+            self.flush_sr();
+        }
+    }
+
+    fn flush_sr(&mut self) {
+        realign_batch(
+            &self.sr_batch,
+            self.realigner,
+            &mut self.cache,
+            self.threads,
+            self.pad,
+            self.indel,
+            self.min_entropy,
+            &mut self.summary,
+            &mut self.profile,
+        );
+        self.sr_batch.clear();
+    }
+
+    pub fn finish(mut self) -> Summary {
+        self.flush_sr();
+        let mut summary = self.summary;
+        summary.sr_cache_hits = self.cache.hits;
+        summary.sr_cache_misses = self.cache.misses;
+        self.pairs.finish(&mut summary);
+        if let Some(mut p) = self.profile {
+            p.peak_pair_cache = summary.sp_peak_pending;
+            summary.profile = Some(p);
+        }
+        summary
+    }
+}
 
-        // Full-read realignment against the locus.
-        let read_seq = rec.seq().as_bytes();
-        let full_hits = realigner.align(&read_seq);
-        let Some(primary) = full_hits.first() else {
+/// Paired read that is "mostly aligned".  Matches the C++ condition
+/// readScore >= readLen - PAD, where score is the number of aligned bases.
+/// Aligned == readLen - soft_clip.
+fn sp_candidate(rec: &Record, read_len: i64, clip: i64, pad: i64) -> bool {
+    rec.is_paired()
+        && !rec.is_unmapped()
+        && !rec.is_mate_unmapped()
+        && read_len - clip >= read_len - pad
+}
+
+/// A mostly-aligned read waiting for its mate.  BAM coordinates are 32-bit,
+/// and the sequence is reduced to its entropy verdict on arrival.
+#[derive(Clone, Copy)]
+struct PendingMate {
+    start: i32,
+    end: i32,
+    mate_pos: i32,
+    reverse: bool,
+    complex: bool,
+}
+
+/// Streaming split-pair detector.
+///
+/// The first mate of a pair to arrive is held under a 64-bit hash of its
+/// qname, and only if its `mtid`/`mpos` say the mate will be fetched later
+/// from this window.  The pair is scored as soon as the second mate
+/// arrives.  Held reads are evicted once the scan passes their mate's
+/// position without seeing it.  Input is coordinate-sorted (it comes from
+/// an indexed fetch), so the earlier mate is always the held one and left
+/// and right come out as the old sort by start gave them.
+///
+/// This counts exactly the qnames that have two mostly-aligned primary
+/// records in the window, provided mate fields are consistent (as written by
+/// aligners and `samtools fixmate`).  Pairs are emitted in scan order, so
+/// SP-DETAILS is also deterministic now.
+struct PairScan {
+    chrom: String,
+    end: i64,
+    indel: i64,
+    min_entropy: f64,
+    pending: HashMap<u64, PendingMate>,
+    // (mate position, qname hash), soonest first.  Entries already paired
+    // off are skipped lazily on pop.
+    expiry: BinaryHeap<Reverse<(i32, u64)>>,
+    peak_pending: usize,
+}
+
+impl PairScan {
+    fn new(chrom: &str, end: i64, indel: i64, min_entropy: f64) -> Self {
+        Self {
+            chrom: chrom.to_string(),
+            end,
+            indel,
+            min_entropy,
+            pending: HashMap::new(),
+            expiry: BinaryHeap::new(),
+            peak_pending: 0,
+        }
+    }
+
+    fn push(&mut self, rec: &Record, header_names: &[String], summary: &mut Summary) {
+        let pos = rec.pos() as i32;
+        self.evict_before(pos);
+
+        let mut h = Fnv1a::new();
+        h.write(rec.qname());
+        let key = h.finish();
+
+        if let Some(left) = self.pending.remove(&key) {
+            summary.sp_total += 1;
+            let dist = (pos as i64 - left.start as i64).abs();
+            // The held mate's entropy verdict was only computed if the
+            // distance it predicted from `mpos` could pass.
+            if dist < self.indel
+                || !left.complex
+                || trinucleotide_entropy(&rec.seq().as_bytes()) < self.min_entropy
+            {
+                return;
+            }
+            summary.sp_signal += 1;
+            let chrom = header_names
+                .get(rec.tid() as usize)
+                .map(String::as_str)
+                .unwrap_or(&self.chrom);
+            append_detail(
+                &mut summary.sp_details,
+                chrom, left.start as i64, left.end as i64, strand(left.reverse),
+                chrom, rec.pos(), rec.cigar().end_pos(), strand(rec.is_reverse()),
+            );
+            return;
+        }
+
+        // Hold this read only if its mate is still to come in this window.
+        let mate_pos = rec.mpos();
+        if rec.mtid() != rec.tid() || mate_pos < rec.pos() || mate_pos >= self.end {
+            return;
+        }
+        let complex = (mate_pos - rec.pos()).abs() >= self.indel
+            && trinucleotide_entropy(&rec.seq().as_bytes()) >= self.min_entropy;
+        self.pending.insert(
+            key,
+            PendingMate {
+                start: pos,
+                end: rec.cigar().end_pos() as i32,
+                mate_pos: mate_pos as i32,
+                reverse: rec.is_reverse(),
+                complex,
+            },
+        );
+        self.expiry.push(Reverse((mate_pos as i32, key)));
+        self.peak_pending = self.peak_pending.max(self.pending.len());
+    }
+
+    /// Drop held reads whose mate position the scan has moved past.
+    fn evict_before(&mut self, pos: i32) {
+        while let Some(&Reverse((mate_pos, key))) = self.expiry.peek() {
+            if mate_pos >= pos {
+                break;
+            }
+            self.expiry.pop();
+            if self.pending.get(&key).is_some_and(|m| m.mate_pos == mate_pos) {
+                self.pending.remove(&key);
+            }
+        }
+    }
+
+    fn finish(self, summary: &mut Summary) {
+        summary.sp_peak_pending = self.peak_pending as u64;
+        // hashbrown keeps one control byte per bucket next to each slot.
+        summary.sp_peak_bytes = (self.pending.capacity() * (size_of::<(u64, PendingMate)>() + 1)
+            + self.expiry.capacity() * size_of::<Reverse<(i32, u64)>>())
+            as u64;
+    }
+}
+
+fn strand(reverse: bool) -> char {
+    if reverse { '-' } else { '+' }
+}
+
+/// Realign one chunk of clipped candidates (in scan order) and append the
+/// SR calls to `summary`.
+#[allow(clippy::too_many_arguments)]
+fn realign_batch(
+    reads: &[Vec<u8>],
+    realigner: &Realigner,
+    cache: &mut HitCache,
+    threads: usize,
+    pad: i64,
+    indel: i64,
+    min_entropy: f64,
+    summary: &mut Summary,
+    profile: &mut Option<Profile>,
+) {
+    if reads.is_empty() {
+        return;
+    }
+    let mut lap = Lap::start(profile.is_some());
+    let (mut realign_seconds, mut entropy_seconds) = (0.0, 0.0);
+
+    // Full-read realignment against the locus.
+    let queries: Vec<&[u8]> = reads.iter().map(|r| r.as_slice()).collect();
+    let mut mem_align1_calls = 0;
+    let full_hits = align_cached(realigner, cache, &queries, threads, &mut mem_align1_calls);
+    realign_seconds += lap.split();
+
+    // Split the reads that still carry a significant clip, then realign
+    // both halves of every survivor in one batch: halves[2k], halves[2k+1]
+    // are the left/right parts of splits[k].  SR Condition 4 (sequence
+    // complexity of each half) needs no alignment, so it is applied here.
+    let mut splits: Vec<(&[u8], &[u8])> = Vec::new();
+    for (read_seq, hits) in reads.iter().zip(full_hits.iter()) {
+        let read_len = read_seq.len() as i64;
+        let Some(primary) = hits.first() else {
             continue;
         };
-
-        // The realigned primary must still carry a significant clip on one
-        // side — otherwise the original clip was just noise and the read is
-        // not chimeric against this locus.
-        let realigned_clip_left = primary.query_start;
-        let realigned_clip_right = read_len - primary.query_end;
-        let (split_idx, left_part, right_part) = if realigned_clip_left > pad
-            && realigned_clip_left < read_len - pad
-        {
-            // Clipped at the 5' end: left = the clipped prefix, right = the
-            // rest starting at the realigned query start.
-            let split = primary.query_start as usize;
-            (split, &read_seq[..split], &read_seq[split..])
-        } else if realigned_clip_right > pad && realigned_clip_right < read_len - pad {
-            // Clipped at the 3' end.
-            let split = primary.query_end as usize;
-            (split, &read_seq[..split], &read_seq[split..])
-        } else {
+        let Some(split) = split_point(primary, read_len, pad) else {
             continue;
         };
-        let _ = split_idx; // retained for future diagnostics
+        let (left_part, right_part) = read_seq.split_at(split);
+        lap.split();
+        let complex = trinucleotide_entropy(left_part) >= min_entropy
+            && trinucleotide_entropy(right_part) >= min_entropy;
+        entropy_seconds += lap.split();
+        if !complex {
+            summary.sr_low_complexity += 1;
+            continue;
+        }
+        splits.push((left_part, right_part));
+    }
+    let halves: Vec<&[u8]> = splits.iter().flat_map(|&(l, r)| [l, r]).collect();
+    lap.split();
+    let half_hits = align_cached(realigner, cache, &halves, threads, &mut mem_align1_calls);
+    realign_seconds += lap.split();
+    if let Some(p) = profile.as_mut() {
+        p.reads_realigned += reads.len() as u64;
+        p.mem_align1_calls += mem_align1_calls;
+        p.realign_seconds += realign_seconds;
+        p.entropy_seconds += entropy_seconds;
+    }
 
-        // Re-align each half independently.
-        let left_hits = realigner.align(left_part);
-        let right_hits = realigner.align(right_part);
-        let (Some(l), Some(r)) = (left_hits.first(), right_hits.first()) else {
+    for (k, &(left_part, right_part)) in splits.iter().enumerate() {
+        let read_len = (left_part.len() + right_part.len()) as i64;
+        let (Some(l), Some(r)) = (half_hits[2 * k].first(), half_hits[2 * k + 1].first()) else {
             continue;
         };
 
@@ -165,43 +474,78 @@ pub fn analyze(
         if dist < indel {
             continue;
         }
-        // SR Condition 4: sequence complexity — each half separately.
-        if trinucleotide_entropy(left_part) < min_entropy
-            || trinucleotide_entropy(right_part) < min_entropy
-        {
-            continue;
-        }
 
         summary.sr_signal += 1;
         write_hit_detail(&mut summary.sr_details, l, r);
     }
+}
 
-    // ---- SP pair scan ---------------------------------------------------
-    for (_, mut mates) in pair_cache.into_iter() {
-        if mates.len() != 2 {
-            continue;
-        }
-        summary.sp_total += 1;
-        mates.sort_by_key(|m| m.start);
-        let (left, right) = (&mates[0], &mates[1]);
-        let dist = (right.start - left.start).abs();
-        if dist < indel {
-            continue;
-        }
-        if trinucleotide_entropy(&left.seq) < min_entropy
-            || trinucleotide_entropy(&right.seq) < min_entropy
-        {
+/// `Realigner::align_batch` through `cache`: each distinct sequence not
+/// already cached is aligned once, in one parallel batch.  Adds the BWA
+/// calls that took to `mem_align1_calls`.
+fn align_cached(
+    realigner: &Realigner,
+    cache: &mut HitCache,
+    queries: &[&[u8]],
+    threads: usize,
+    mem_align1_calls: &mut u64,
+) -> Vec<Vec<Hit>> {
+    let mut out: Vec<Option<Vec<Hit>>> = Vec::with_capacity(queries.len());
+    let mut misses: Vec<&[u8]> = Vec::new();
+    let mut first_miss: HashMap<&[u8], usize> = HashMap::new();
+    let mut pending: Vec<(usize, usize)> = Vec::new();
+    for (i, &q) in queries.iter().enumerate() {
+        if let Some(hits) = cache.get(q) {
+            out.push(Some(hits.to_vec()));
+            cache.hits += 1;
             continue;
         }
-        summary.sp_signal += 1;
-        append_detail(
-            &mut summary.sp_details,
-            &left.chrom, left.start, left.end, left.strand,
-            &right.chrom, right.start, right.end, right.strand,
-        );
+        // A repeat within the batch rides on its first copy's alignment.
+        let m = match first_miss.get(q) {
+            Some(&m) => {
+                cache.hits += 1;
+                m
+            }
+            None => {
+                misses.push(q);
+                first_miss.insert(q, misses.len() - 1);
+                misses.len() - 1
+            }
+        };
+        pending.push((i, m));
+        out.push(None);
     }
+    cache.misses += misses.len() as u64;
 
-    Ok(summary)
+    let (aligned, calls) = realigner.align_batch_counted(&misses, threads);
+    *mem_align1_calls += calls;
+    for (&q, hits) in misses.iter().zip(aligned.iter()) {
+        cache.insert(q, hits);
+    }
+    for (i, m) in pending {
+        out[i] = Some(aligned[m].clone());
+    }
+    out.into_iter().map(Option::unwrap).collect()
+}
+
+/// Query offset at which to split a read, given its realigned primary hit.
+///
+/// The realigned primary must still carry a significant clip on one side —
+/// otherwise the original clip was just noise and the read is not chimeric
+/// against this locus.
+fn split_point(primary: &Hit, read_len: i64, pad: i64) -> Option<usize> {
+    let realigned_clip_left = primary.query_start;
+    let realigned_clip_right = read_len - primary.query_end;
+    if realigned_clip_left > pad && realigned_clip_left < read_len - pad {
+        // Clipped at the 5' end: left = the clipped prefix, right = the
+        // rest starting at the realigned query start.
+        Some(primary.query_start as usize)
+    } else if realigned_clip_right > pad && realigned_clip_right < read_len - pad {
+        // Clipped at the 3' end.
+        Some(primary.query_end as usize)
+    } else {
+        None
+    }
 }
 
 fn soft_clip_len(rec: &Record) -> i64 {
@@ -236,3 +580,243 @@ fn append_detail(
         right_chrom, right_start, right_end, right_strand,
     );
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use rust_htslib::bam::record::CigarString;
+
+    /// The pre-streaming detector: collect every candidate by qname, then
+    /// score qnames seen exactly twice.
+    fn whole_locus_pairs(recs: &[Record], names: &[String], pad: i64, indel: i64, min_entropy: f64) -> Summary {
+        let mut cache: HashMap<Vec<u8>, Vec<&Record>> = HashMap::new();
+        for rec in recs {
+            if rec.is_duplicate() || rec.is_secondary() || rec.is_supplementary() {
+                continue;
+            }
+            let read_len = rec.seq_len() as i64;
+            if sp_candidate(rec, read_len, soft_clip_len(rec), pad) {
+                cache.entry(rec.qname().to_vec()).or_default().push(rec);
+            }
+        }
+        let mut summary = Summary::default();
+        for (_, mut mates) in cache {
+            if mates.len() != 2 {
+                continue;
+            }
+            summary.sp_total += 1;
+            mates.sort_by_key(|m| m.pos());
+            let (l, r) = (mates[0], mates[1]);
+            if (r.pos() - l.pos()).abs() < indel
+                || trinucleotide_entropy(&l.seq().as_bytes()) < min_entropy
+                || trinucleotide_entropy(&r.seq().as_bytes()) < min_entropy
+            {
+                continue;
+            }
+            summary.sp_signal += 1;
+            append_detail(
+                &mut summary.sp_details,
+                &names[l.tid() as usize], l.pos(), l.cigar().end_pos(), strand(l.is_reverse()),
+                &names[r.tid() as usize], r.pos(), r.cigar().end_pos(), strand(r.is_reverse()),
+            );
+        }
+        summary
+    }
+
+    fn sorted_details(details: &str) -> Vec<&str> {
+        let mut v: Vec<&str> = details.split_terminator(';').collect();
+        v.sort_unstable();
+        v
+    }
+
+    /// xorshift64, so the fixture is reproducible without a rand dependency.
+    struct Rng(u64);
+    impl Rng {
+        fn next(&mut self) -> u64 {
+            self.0 ^= self.0 << 13;
+            self.0 ^= self.0 >> 7;
+            self.0 ^= self.0 << 17;
+            self.0
+        }
+        fn below(&mut self, n: u64) -> u64 {
+            self.next() % n
+        }
+    }
+
+    fn mate(qname: &str, pos: i64, mpos: i64, mtid: i32, flags: u16, clip: u32, seq: &[u8]) -> Record {
+        let mut rec = Record::new();
+        let len = seq.len() as u32;
+        let cigar = if clip > 0 {
+            CigarString(vec![Cigar::SoftClip(clip), Cigar::Match(len - clip)])
+        } else {
+            CigarString(vec![Cigar::Match(len)])
+        };
+        rec.set(qname.as_bytes(), Some(&cigar), seq, &vec![30; seq.len()]);
+        rec.set_tid(0);
+        rec.set_pos(pos);
+        rec.set_mtid(mtid);
+        rec.set_mpos(mpos);
+        rec.set_flags(flags);
+        rec
+    }
+
+    /// The pre-prescreen SR path: align every read, then both halves of
+    /// every split, and apply the conditions in their original order.
+    fn sr_unscreened(reads: &[Vec<u8>], r: &Realigner, pad: i64, indel: i64, min_entropy: f64) -> Summary {
+        let mut summary = Summary::default();
+        for read in reads {
+            let Some(primary) = r.align(read).into_iter().next() else {
+                continue;
+            };
+            let Some(split) = split_point(&primary, read.len() as i64, pad) else {
+                continue;
+            };
+            let (lp, rp) = read.split_at(split);
+            let (Some(l), Some(rh)) = (r.align(lp).into_iter().next(), r.align(rp).into_iter().next()) else {
+                continue;
+            };
+            if l.as_score < pad
+                || rh.as_score < pad
+                || l.as_score + rh.as_score < read.len() as i64 - pad / 2
+                || (rh.ref_start - l.ref_start).abs() < indel
+                || trinucleotide_entropy(lp) < min_entropy
+                || trinucleotide_entropy(rp) < min_entropy
+            {
+                continue;
+            }
+            summary.sr_signal += 1;
+            write_hit_detail(&mut summary.sr_details, &l, &rh);
+        }
+        summary
+    }
+
+    #[test]
+    fn prescreen_and_cache_do_not_change_sr_calls() {
+        let dir = tempfile::tempdir().unwrap();
+        let (fa, seq) = crate::realign::tests::toy_reference(dir.path());
+        let seq = seq.as_bytes();
+        let r = Realigner::from_reference(fa.to_str().unwrap(), "chr_toy", 0, seq.len() as i64, "TOY")
+            .expect("index build");
+
+        let mut rng = Rng(0x2545_f491_4f6c_dd1d);
+        let foreign: Vec<u8> = (0..seq.len()).map(|_| b"ACGT"[rng.below(4) as usize]).collect();
+        let mut reads: Vec<Vec<u8>> = Vec::new();
+        for i in 0..300 {
+            let a = rng.below(seq.len() as u64 - 120) as usize;
+            let b = rng.below(seq.len() as u64 - 120) as usize;
+            let cut = 40 + rng.below(40) as usize;
+            let read: Vec<u8> = match i % 5 {
+                // Chimera of two locus segments.
+                0 | 1 => [&seq[a..a + cut], &seq[b..b + 120 - cut]].concat(),
+                // Locus segment with a foreign clip (adapter-like).
+                2 => [&foreign[a..a + cut], &seq[b..b + 120 - cut]].concat(),
+                // Entirely foreign.
+                3 => foreign[a..a + 120].to_vec(),
+                // Low-complexity clip.
+                _ => [&vec![b'A'; cut][..], &seq[b..b + 120 - cut]].concat(),
+            };
+            // PCR-style copies.
+            for _ in 0..1 + rng.below(3) {
+                reads.push(read.clone());
+            }
+        }
+
+        for min_entropy in [50.0, 88.0] {
+            let (pad, indel) = (30, 1000);
+            let expect = sr_unscreened(&reads, &r, pad, indel, min_entropy);
+
+            // Profiled, which must not change any call.
+            let mut got = Summary::default();
+            let mut profile = Some(Profile::default());
+            let mut cache = HitCache::new(64);
+            let mut batch = Vec::new();
+            for read in &reads {
+                if r.seeds().may_split(read) {
+                    batch.push(read.clone());
+                } else {
+                    got.sr_prescreened += 1;
+                }
+                if batch.len() == 50 {
+                    realign_batch(&batch, &r, &mut cache, 4, pad, indel, min_entropy, &mut got, &mut profile);
+                    batch.clear();
+                }
+            }
+            realign_batch(&batch, &r, &mut cache, 4, pad, indel, min_entropy, &mut got, &mut profile);
+
+            assert!(expect.sr_signal > 0);
+            assert_eq!(got.sr_signal, expect.sr_signal);
+            assert_eq!(got.sr_details, expect.sr_details);
+            assert!(got.sr_prescreened > 0);
+            assert!(cache.hits > 0 && cache.misses > 0);
+            let profile = profile.unwrap();
+            assert_eq!(profile.reads_realigned, reads.len() as u64 - got.sr_prescreened);
+            // Cache hits never reach BWA; misses do unless BWA cannot see them.
+            assert!(profile.mem_align1_calls > 0 && profile.mem_align1_calls <= cache.misses);
+            assert!(profile.realign_seconds > 0.0);
+        }
+    }
+
+    #[test]
+    fn streaming_pairs_match_whole_locus_scan() {
+        let (end, pad, indel, min_entropy) = (200_000_i64, 30, 10_000, 50.0);
+        let names = vec!["chr14".to_string(), "chr7".to_string()];
+        let mut rng = Rng(0x9e37_79b9_7f4a_7c15);
+        let complex: Vec<u8> = (0..100).map(|_| b"ACGT"[rng.below(4) as usize]).collect();
+        let simple = vec![b'A'; 100];
+
+        let mut recs = Vec::new();
+        for i in 0..4000 {
+            let qname = format!("read{i}");
+            let a = rng.below(end as u64) as i64;
+            // Mostly short inserts, some V(D)J-scale jumps, some past `end`.
+            let b = match rng.below(10) {
+                0..=5 => a + rng.below(600) as i64,
+                6..=8 => a + indel + rng.below(50_000) as i64,
+                _ => end + rng.below(1_000) as i64,
+            };
+            let seq = |rng: &mut Rng| if rng.below(8) == 0 { &simple } else { &complex };
+            let flag = |rng: &mut Rng, rev: u16| {
+                let mut f = 0x1 | rev;
+                match rng.below(40) {
+                    0 => f |= 0x400,
+                    1 => f |= 0x8,
+                    2 => f &= !0x1,
+                    _ => {}
+                }
+                f
+            };
+            let clip = |rng: &mut Rng| if rng.below(10) == 0 { 45 } else { 0 };
+            let mtid = if rng.below(50) == 0 { 1 } else { 0 };
+            let (fa, ca, sa) = (flag(&mut rng, 0x20), clip(&mut rng), seq(&mut rng));
+            recs.push(mate(&qname, a, b, mtid, fa, ca, sa));
+            if b < end && mtid == 0 {
+                let (fb, cb, sb) = (flag(&mut rng, 0x10), clip(&mut rng), seq(&mut rng));
+                recs.push(mate(&qname, b, a, mtid, fb, cb, sb));
+            }
+        }
+        recs.sort_by_key(|r| r.pos());
+
+        let expect = whole_locus_pairs(&recs, &names, pad, indel, min_entropy);
+        let mut scan = PairScan::new("chr14", end, indel, min_entropy);
+        let mut got = Summary::default();
+        for rec in &recs {
+            if rec.is_duplicate() || rec.is_secondary() || rec.is_supplementary() {
+                continue;
+            }
+            if sp_candidate(rec, rec.seq_len() as i64, soft_clip_len(rec), pad) {
+                scan.push(rec, &names, &mut got);
+            }
+        }
+        let peak = scan.peak_pending;
+        scan.finish(&mut got);
+
+        assert!(expect.sp_signal > 0 && expect.sp_total > expect.sp_signal);
+        assert_eq!(got.sp_total, expect.sp_total);
+        assert_eq!(got.sp_signal, expect.sp_signal);
+        assert_eq!(sorted_details(&got.sp_details), sorted_details(&expect.sp_details));
+        // Only reads whose mate lies ahead are ever held, never the locus.
+        assert!(peak > 0 && peak < recs.len() / 2);
+        assert_eq!(got.sp_peak_pending, peak as u64);
+        assert!(got.sp_peak_bytes > 0);
+    }
+}
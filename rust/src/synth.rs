@@ -0,0 +1,402 @@
+// Deterministic synthetic locus data for benchmarks and tests.
+//
+// `simulate` draws a random locus reference and paired-end reads over it
+// from one xorshift seed: background fragments at a chosen mean depth, a
+// fraction of reads whose end is replaced by foreign sequence (soft-clipped
+// in the BAM), flagged PCR duplicates, and a set of planted V(D)J-style
+// junctions.  A junction joins a point in the first 40% of the reference to
+// one in the last 40%, so its two sides are at least a fifth of the
+// reference apart; reads straddling it are soft-clipped at the junction and
+// fragments spanning it become discordant pairs, i.e. SR and SP evidence.
+//
+// `write` lays the result out as a FASTA (+ FAI) and a coordinate-sorted,
+// indexed BAM that every entry point of the core can read.
+
+use std::io::{self, Write as _};
+use std::path::{Path, PathBuf};
+
+use rust_htslib::bam::{self, header::HeaderRecord, record::Cigar, record::CigarString, Header};
+
+#[derive(Clone, Debug)]
+pub struct SynthParams {
+    pub seed: u64,
+    /// Length of the single reference contig (the whole locus).
+    pub ref_len: usize,
+    pub read_len: usize,
+    /// Fragment length; every pair spans exactly this much sequence.
+    pub insert: usize,
+    /// Mean read depth of the background fragments.
+    pub depth: f64,
+    /// Fraction of background reads with a foreign, soft-clipped end.
+    pub clip_rate: f64,
+    /// Fraction of background fragments emitted again as flagged duplicates.
+    pub dup_rate: f64,
+    pub junctions: usize,
+    /// Fragments drawn across each junction.
+    pub junction_depth: usize,
+}
+
+impl Default for SynthParams {
+    fn default() -> Self {
+        Self {
+            seed: 0x9E37_79B9_7F4A_7C15,
+            ref_len: 200_000,
+            read_len: 100,
+            insert: 300,
+            depth: 30.0,
+            clip_rate: 0.02,
+            dup_rate: 0.05,
+            junctions: 8,
+            junction_depth: 20,
+        }
+    }
+}
+
+/// One BAM record.  `seq` is on the forward reference strand, as BAM
+/// stores it.
+#[derive(Clone, Debug)]
+pub struct SynthRead {
+    pub qname: String,
+    pub pos: i64,
+    pub mpos: i64,
+    pub tlen: i64,
+    pub flags: u16,
+    pub cigar: Vec<Cigar>,
+    pub seq: Vec<u8>,
+}
+
+#[derive(Clone, Debug)]
+pub struct SynthSample {
+    pub chrom: String,
+    pub reference: Vec<u8>,
+    /// Sorted by position.
+    pub reads: Vec<SynthRead>,
+    /// Planted `(left, right)` breakpoints: reference up to `left` joined to
+    /// reference from `right` on.
+    pub junctions: Vec<(i64, i64)>,
+}
+
+pub struct SynthFiles {
+    pub fasta: PathBuf,
+    pub bam: PathBuf,
+}
+
+const PAIRED: u16 = 0x1;
+const PROPER_PAIR: u16 = 0x2;
+const REVERSE: u16 = 0x10;
+const MATE_REVERSE: u16 = 0x20;
+const FIRST: u16 = 0x40;
+const SECOND: u16 = 0x80;
+const DUPLICATE: u16 = 0x400;
+
+struct Rng(u64);
+
+impl Rng {
+    fn next(&mut self) -> u64 {
+        self.0 ^= self.0 << 13;
+        self.0 ^= self.0 >> 7;
+        self.0 ^= self.0 << 17;
+        self.0
+    }
+
+    /// Uniform in `[lo, hi)`.
+    fn range(&mut self, lo: usize, hi: usize) -> usize {
+        lo + (self.next() % (hi - lo).max(1) as u64) as usize
+    }
+
+    fn chance(&mut self, p: f64) -> bool {
+        ((self.next() >> 11) as f64 / (1_u64 << 53) as f64) < p
+    }
+
+    fn bases(&mut self, n: usize) -> Vec<u8> {
+        (0..n).map(|_| b"ACGT"[(self.next() & 3) as usize]).collect()
+    }
+}
+
+/// Where a fragment's sequence comes from: `left` bases ending at
+/// reference `a`, then reference from `b` on.  A contiguous fragment has
+/// `b == a`.
+struct Fragment {
+    a: usize,
+    b: usize,
+    left: usize,
+    len: usize,
+}
+
+impl Fragment {
+    fn seq(&self, reference: &[u8]) -> Vec<u8> {
+        let mut seq = reference[self.a - self.left..self.a].to_vec();
+        seq.extend_from_slice(&reference[self.b..self.b + self.len - self.left]);
+        seq
+    }
+
+    /// Placement of the fragment bases `[off, off + n)`: the side holding
+    /// most of them is the aligned part, the rest is soft-clipped.
+    fn place(&self, off: usize, n: usize) -> (i64, Vec<Cigar>) {
+        let lp = self.left.saturating_sub(off).min(n);
+        let rp = n - lp;
+        if lp >= rp {
+            let pos = (self.a - self.left + off) as i64;
+            (pos, with_clip(lp, rp, false))
+        } else {
+            let pos = (self.b + off.saturating_sub(self.left)) as i64;
+            (pos, with_clip(rp, lp, true))
+        }
+    }
+}
+
+fn with_clip(matched: usize, clipped: usize, clip_first: bool) -> Vec<Cigar> {
+    let m = Cigar::Match(matched as u32);
+    match (clipped, clip_first) {
+        (0, _) => vec![m],
+        (c, true) => vec![Cigar::SoftClip(c as u32), m],
+        (c, false) => vec![m, Cigar::SoftClip(c as u32)],
+    }
+}
+
+pub fn simulate(p: &SynthParams) -> SynthSample {
+    assert!(p.read_len <= p.insert && 5 * p.insert < p.ref_len);
+    let mut rng = Rng(p.seed | 1);
+    let reference = rng.bases(p.ref_len);
+    let mut reads = Vec::new();
+
+    let fragments = (p.depth * p.ref_len as f64 / (2 * p.read_len) as f64).round() as usize;
+    for i in 0..fragments {
+        let a = rng.range(0, p.ref_len - p.insert);
+        let frag = Fragment { a, b: a, left: 0, len: p.insert };
+        let mut pair = read_pair(&frag, &reference, p.read_len, &format!("bg:{i}"));
+        for read in pair.iter_mut() {
+            if rng.chance(p.clip_rate) {
+                clip_foreign(read, &mut rng, p.read_len);
+            }
+        }
+        // A clip at the start moves a read; keep its mate's view in step.
+        pair[0].mpos = pair[1].pos;
+        pair[1].mpos = pair[0].pos;
+        if rng.chance(p.dup_rate) {
+            for read in &pair {
+                let mut dup = read.clone();
+                dup.qname.push_str(":dup");
+                dup.flags |= DUPLICATE;
+                reads.push(dup);
+            }
+        }
+        reads.extend(pair);
+    }
+
+    let fifth = p.ref_len / 5;
+    let mut junctions = Vec::with_capacity(p.junctions);
+    for j in 0..p.junctions {
+        let a = rng.range(p.insert, 2 * fifth);
+        let b = rng.range(3 * fifth, p.ref_len - p.insert);
+        junctions.push((a as i64, b as i64));
+        for k in 0..p.junction_depth {
+            let left = rng.range(1, p.insert);
+            let frag = Fragment { a, b, left, len: p.insert };
+            reads.extend(read_pair(&frag, &reference, p.read_len, &format!("jn:{j}:{k}")));
+        }
+    }
+
+    reads.sort_by(|x, y| (x.pos, &x.qname).cmp(&(y.pos, &y.qname)));
+    SynthSample { chrom: "chr_synth".into(), reference, reads, junctions }
+}
+
+/// First read forward from the fragment start, second reverse from its end.
+fn read_pair(frag: &Fragment, reference: &[u8], read_len: usize, qname: &str) -> [SynthRead; 2] {
+    let seq = frag.seq(reference);
+    let r2_off = frag.len - read_len;
+    let (p1, c1) = frag.place(0, read_len);
+    let (p2, c2) = frag.place(r2_off, read_len);
+    let span = p2 + read_len as i64 - p1;
+    let proper = (0..=2 * frag.len as i64).contains(&span);
+    let pair_flags = PAIRED | if proper { PROPER_PAIR } else { 0 };
+    let tlen = if proper { span } else { 0 };
+    [
+        SynthRead {
+            qname: qname.into(),
+            pos: p1,
+            mpos: p2,
+            tlen,
+            flags: pair_flags | FIRST | MATE_REVERSE,
+            cigar: c1,
+            seq: seq[..read_len].to_vec(),
+        },
+        SynthRead {
+            qname: qname.into(),
+            pos: p2,
+            mpos: p1,
+            tlen: -tlen,
+            flags: pair_flags | SECOND | REVERSE,
+            cigar: c2,
+            seq: seq[r2_off..].to_vec(),
+        },
+    ]
+}
+
+/// Replace a quarter to a half of one end of an unclipped read with random
+/// sequence and soft-clip it.
+fn clip_foreign(read: &mut SynthRead, rng: &mut Rng, read_len: usize) {
+    if read.cigar.len() != 1 {
+        return;
+    }
+    let n = rng.range(read_len / 4, read_len / 2);
+    let foreign = rng.bases(n);
+    if rng.chance(0.5) {
+        read.seq[..n].copy_from_slice(&foreign);
+        read.pos += n as i64;
+        read.cigar = with_clip(read_len - n, n, true);
+    } else {
+        read.seq[read_len - n..].copy_from_slice(&foreign);
+        read.cigar = with_clip(read_len - n, n, false);
+    }
+}
+
+/// Write `<dir>/<chrom>.fa` (+ `.fai`) and an indexed `<dir>/<chrom>.bam`.
+pub fn write(sample: &SynthSample, dir: &Path) -> io::Result<SynthFiles> {
+    let htslib = |e: rust_htslib::errors::Error| io::Error::new(io::ErrorKind::Other, e.to_string());
+    let chrom = &sample.chrom;
+
+    let fasta = dir.join(format!("{chrom}.fa"));
+    let mut fa = io::BufWriter::new(std::fs::File::create(&fasta)?);
+    writeln!(fa, ">{chrom}")?;
+    fa.write_all(&sample.reference)?;
+    writeln!(fa)?;
+    fa.flush()?;
+    // <name>\t<len>\t<offset>\t<linebases>\t<linewidth>, one sequence line.
+    let len = sample.reference.len();
+    std::fs::write(
+        dir.join(format!("{chrom}.fa.fai")),
+        format!("{chrom}\t{len}\t{}\t{len}\t{}\n", chrom.len() + 2, len + 1),
+    )?;
+
+    let bam_path = dir.join(format!("{chrom}.bam"));
+    let mut header = Header::new();
+    header.push_record(HeaderRecord::new(b"HD").push_tag(b"VN", &"1.6").push_tag(b"SO", &"coordinate"));
+    header.push_record(HeaderRecord::new(b"SQ").push_tag(b"SN", chrom).push_tag(b"LN", &len));
+    {
+        let mut writer = bam::Writer::from_path(&bam_path, &header, bam::Format::Bam).map_err(htslib)?;
+        let mut rec = bam::Record::new();
+        for read in &sample.reads {
+            let qual = vec![30_u8; read.seq.len()];
+            rec.set(read.qname.as_bytes(), Some(&CigarString(read.cigar.clone())), &read.seq, &qual);
+            rec.set_tid(0);
+            rec.set_pos(read.pos);
+            rec.set_mtid(0);
+            rec.set_mpos(read.mpos);
+            rec.set_insert_size(read.tlen);
+            rec.set_mapq(60);
+            rec.set_flags(read.flags);
+            writer.write(&rec).map_err(htslib)?;
+        }
+    }
+    bam::index::build(&bam_path, None, bam::index::Type::Bai, 1).map_err(htslib)?;
+    Ok(SynthFiles { fasta, bam: bam_path })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn clipped(read: &SynthRead) -> usize {
+        read.cigar
+            .iter()
+            .map(|c| match c {
+                Cigar::SoftClip(n) => *n as usize,
+                _ => 0,
+            })
+            .sum()
+    }
+
+    #[test]
+    fn simulation_is_deterministic_and_honours_rates() {
+        let p = SynthParams { ref_len: 50_000, ..SynthParams::default() };
+        let sample = simulate(&p);
+        let again = simulate(&p);
+        assert_eq!(sample.reference, again.reference);
+        assert_eq!(sample.reads.len(), again.reads.len());
+        assert!(sample.reads.iter().zip(&again.reads).all(|(x, y)| x.qname == y.qname && x.seq == y.seq));
+        assert!(sample.reads.windows(2).all(|w| w[0].pos <= w[1].pos));
+
+        let background: Vec<&SynthRead> =
+            sample.reads.iter().filter(|r| r.qname.starts_with("bg:")).collect();
+        let primary = background.iter().filter(|r| r.flags & DUPLICATE == 0).count();
+        let depth = (primary * p.read_len) as f64 / p.ref_len as f64;
+        assert!((depth - p.depth).abs() < 0.5, "depth {depth}");
+        let dups = background.len() - primary;
+        let dup_rate = dups as f64 / primary as f64;
+        assert!((dup_rate - p.dup_rate).abs() < 0.02, "dup rate {dup_rate}");
+        let clips = background.iter().filter(|r| r.flags & DUPLICATE == 0 && clipped(r) > 0).count();
+        let clip_rate = clips as f64 / primary as f64;
+        assert!((clip_rate - p.clip_rate).abs() < 0.01, "clip rate {clip_rate}");
+
+        // Aligned bases of every read match the reference where placed.
+        for read in &sample.reads {
+            let (mut q, mut r) = (0_usize, read.pos as usize);
+            for op in &read.cigar {
+                match *op {
+                    Cigar::SoftClip(n) => q += n as usize,
+                    Cigar::Match(n) => {
+                        let n = n as usize;
+                        assert_eq!(read.seq[q..q + n], sample.reference[r..r + n], "{}", read.qname);
+                        q += n;
+                        r += n;
+                    }
+                    _ => unreachable!(),
+                }
+            }
+            assert_eq!(q, read.seq.len());
+        }
+    }
+
+    #[test]
+    fn junction_reads_straddle_planted_breakpoints() {
+        let p = SynthParams { ref_len: 50_000, depth: 0.0, ..SynthParams::default() };
+        let sample = simulate(&p);
+        assert_eq!(sample.reads.len(), 2 * p.junctions * p.junction_depth);
+        for &(a, b) in &sample.junctions {
+            assert!(b - a >= p.ref_len as i64 / 5);
+        }
+        // Junction fragments yield both clipped reads and discordant pairs,
+        // and every clip sits exactly on a breakpoint.
+        let split = sample.reads.iter().filter(|r| clipped(r) > 0).count();
+        let discordant = sample.reads.iter().filter(|r| r.flags & PROPER_PAIR == 0).count();
+        assert!(split > 0 && discordant > 0);
+        for read in sample.reads.iter().filter(|r| clipped(r) > 0) {
+            let (a, b) = sample.junctions[read.qname[3..].split(':').next().unwrap().parse::<usize>().unwrap()];
+            let end = read.pos + (read.seq.len() - clipped(read)) as i64;
+            assert!(end == a || read.pos == b, "{} at {}", read.qname, read.pos);
+        }
+    }
+
+    #[test]
+    fn written_sample_yields_planted_calls() {
+        let p = SynthParams { ref_len: 50_000, depth: 10.0, ..SynthParams::default() };
+        let sample = simulate(&p);
+        let dir = tempfile::tempdir().unwrap();
+        let files = write(&sample, dir.path()).unwrap();
+        let (fasta, bam) = (files.fasta.to_str().unwrap(), files.bam.to_str().unwrap());
+        let len = p.ref_len as i64;
+        let r = crate::realign::Realigner::from_reference(fasta, &sample.chrom, 0, len, "SYN").unwrap();
+
+        let scan = |profile| {
+            let io = crate::bamio::IoConfig::default();
+            crate::split::analyze(bam, &sample.chrom, 0, len, 30, 5_000, 50.0, &r, 2, io, profile).unwrap()
+        };
+        let plain = scan(false);
+        let profiled = scan(true);
+        assert!(plain.sr_signal > 0 && plain.sp_signal > 0);
+        assert!(plain.profile.is_none());
+        assert_eq!(profiled.sr_details, plain.sr_details);
+        assert_eq!(profiled.sp_details, plain.sp_details);
+
+        let prof = profiled.profile.unwrap();
+        assert_eq!(prof.reads_scanned, sample.reads.len() as u64);
+        // At most the whole read and its two halves go to BWA, and only on
+        // a cache miss.
+        assert!(prof.mem_align1_calls > 0);
+        assert!(prof.mem_align1_calls <= profiled.sr_cache_misses);
+        assert!(prof.mem_align1_calls <= 3 * prof.reads_realigned);
+        assert_eq!(prof.peak_pair_cache, profiled.sp_peak_pending);
+        assert!(prof.reads_realigned > 0 && prof.decode_seconds > 0.0);
+    }
+}
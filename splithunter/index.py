@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+# -*- coding: UTF-8 -*-
+
+"""
+Prebuild the per-locus BWA-MEM indexes used by splithunter_run into the
+persistent index cache, so that a cohort run only ever maps them.
+"""
+
+import argparse
+import logging
+import sys
+
+from . import _core
+from .loci import HG38_LOCI, HG38_LOCI_BY_NAME, pick_contig
+from .utils import DefaultHelpParser, get_abs_path
+
+logging.basicConfig()
+logger = logging.getLogger(__name__)
+
+
+def _fasta_contigs(reference):
+    with open(reference + ".fai") as fh:
+        return {line.split("\t", 1)[0] for line in fh if line.strip()}
+
+
+def warm(reference, loci, cache_dir=None):
+    """Build any missing cache entries and return ``{locus: entry_path}``."""
+    contigs = _fasta_contigs(reference)
+    entries = {}
+    for locus in loci:
+        try:
+            chrom = pick_contig(locus, contigs)
+        except KeyError as e:
+            logger.warning("%s", e)
+            continue
+        entries[locus.name] = _core.prebuild_index(
+            reference, locus.name, chrom, locus.start, locus.end,
+            cache_dir=cache_dir,
+        )
+        logger.info("%s @ %s:%d-%d -> %s", locus.name, chrom,
+                    locus.start, locus.end, entries[locus.name])
+    return entries
+
+
+def main(args=None):
+    p = DefaultHelpParser(
+        description=__doc__,
+        prog="splithunter_index",
+        formatter_class=argparse.ArgumentDefaultsHelpFormatter,
+    )
+    p.add_argument('--reference', required=True,
+                   help='Indexed FASTA reference (.fai alongside)')
+    p.add_argument('--locus', default="", choices=tuple(HG38_LOCI_BY_NAME),
+                   help="Build only one locus (default: all)")
+    p.add_argument('--index-cache', default=None,
+                   help='Cache directory (default: $SPLITHUNTER_INDEX_CACHE '
+                        'or ~/.cache/splithunter/bwa)')
+    args = p.parse_args(args)
+    logger.setLevel(logging.INFO)
+
+    loci = [HG38_LOCI_BY_NAME[args.locus]] if args.locus else HG38_LOCI
+    entries = warm(get_abs_path(args.reference), loci, args.index_cache)
+    for name, path in entries.items():
+        print(f"{name}\t{path}")
+
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
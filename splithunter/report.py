@@ -15,15 +15,21 @@ import sys
 
 from multiprocessing import Pool, cpu_count
 
+import numpy as np
 import pandas as pd
 
 from .loci import HG38_LOCI, HG38_TCELL_SEGMENTS
 from .utils import DefaultHelpParser
 
+# Per-locus JSON key suffix holding the binned coverage track written by
+# splithunter_run; used for plotting only, so it is kept out of the TSV.
+COVERAGE_BINS = "COVERAGE-BINS"
+
 
 def df_to_tsv(df, tsvfile, index=False):
     dd = ["SampleKey"]
-    columns = dd + sorted([x for x in df.columns if x not in dd])
+    columns = dd + sorted([x for x in df.columns
+                           if x not in dd and not x.endswith(COVERAGE_BINS)])
 
     df = df.reindex(columns=columns)
     df = df.sort_values("SampleKey")
@@ -167,20 +173,19 @@ def _fmt(x, spec=".4f", na="NA"):
         return str(x)
 
 
-def _bin_coverage(cov, start, end, nbins=600):
+def _bin_coverage(positions, depths, start, end, nbins=600):
     binw = (end - start) / nbins
-    sums = [0.0] * nbins
-    counts = [0] * nbins
-    for p, d in cov:
-        i = int((p - start) / binw)
-        if 0 <= i < nbins:
-            sums[i] += d
-            counts[i] += 1
+    pos = np.asarray(positions, dtype=float)
+    dep = np.asarray(depths, dtype=float)
+    idx = np.trunc((pos - start) / binw).astype(np.int64)
+    keep = (idx >= 0) & (idx < nbins)
+    idx, dep = idx[keep], dep[keep]
+    sums = np.bincount(idx, weights=dep, minlength=nbins)
+    counts = np.bincount(idx, minlength=nbins)
     xs, ys = [], []
-    for i in range(nbins):
-        if counts[i]:
-            xs.append(int(start + (i + 0.5) * binw))
-            ys.append(sums[i] / counts[i])
+    for i in np.flatnonzero(counts):
+        xs.append(int(start + (i + 0.5) * binw))
+        ys.append(float(sums[i] / counts[i]))
     return xs, ys
 
 
@@ -450,21 +455,26 @@ def _render_locus_block(record, locus_name, locus_obj, segs):
             f'<td>{_fmt(tlwr, ".4f")} – {_fmt(tupr, ".4f")}</td>'
             f'<td>{bar}</td></tr></tbody></table>')
 
-        if bam and op.exists(bam):
+        xs = ys = None
+        bins = record.get(pre + COVERAGE_BINS)
+        if isinstance(bins, (list, tuple)) and len(bins) == 2:
+            xs, ys = bins
+        elif bam and op.exists(bam):
             chrom = _resolve_contig(bam, segs.chrom)
             cov = _try_coverage(bam, chrom, segs.full[0], segs.full[1])
-            if cov:
-                xs, ys = _bin_coverage(cov, segs.full[0], segs.full[1])
-                parts.append('<h3>Coverage track</h3>')
-                parts.append(_coverage_svg(
-                    xs, ys, segs.full, segs.focal,
-                    segs.left_baseline, segs.right_baseline,
-                    focal_med, base_med))
-                parts.append('<div class="legend">'
-                             '<span style="background:#3498db;opacity:.5"></span>read depth · '
-                             '<span style="background:#c0392b"></span>focal V-J · '
-                             '<span style="background:#2c3e50"></span>baseline · '
-                             'dashed = median</div>')
+            if cov is not None and len(cov[0]):
+                xs, ys = _bin_coverage(*cov, segs.full[0], segs.full[1])
+        if xs:
+            parts.append('<h3>Coverage track</h3>')
+            parts.append(_coverage_svg(
+                xs, ys, segs.full, segs.focal,
+                segs.left_baseline, segs.right_baseline,
+                focal_med, base_med))
+            parts.append('<div class="legend">'
+                         '<span style="background:#3498db;opacity:.5"></span>read depth · '
+                         '<span style="background:#c0392b"></span>focal V-J · '
+                         '<span style="background:#2c3e50"></span>baseline · '
+                         'dashed = median</div>')
 
     if sr_events or sp_events:
         parts.append('<h3>Breakpoint arc plot</h3>')
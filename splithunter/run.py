@@ -15,9 +15,12 @@ import os.path as op
 import sys
 import time
 
+from collections import Counter
+from concurrent.futures import ThreadPoolExecutor, as_completed
 from datetime import timedelta
 from multiprocessing import Pool, cpu_count
 
+import numpy as np
 import pandas as pd
 
 from . import _core
@@ -30,7 +33,8 @@ from .loci import (
     pick_contig,
 )
 from . import tcell as sh_tcell
-from .utils import DefaultHelpParser, get_abs_path, mkdir
+from .report import COVERAGE_BINS, _bin_coverage
+from .utils import DefaultHelpParser, get_abs_path, io_kwargs, mkdir, set_io_opts
 
 logging.basicConfig()
 logger = logging.getLogger(__name__)
@@ -53,8 +57,18 @@ def set_argparse():
                    help="Compute only one locus (default: all)")
     p.add_argument('--cpus',
                    help='Number of CPUs to use', type=int, default=cpu_count())
+    p.add_argument('--threads', type=int, default=1,
+                   help='Realignment threads per locus (results do not '
+                        'depend on this)')
+    p.add_argument('--scheduler', choices=("native", "process"), default="native",
+                   help='native: one process, --cpus threads working through '
+                        'every (sample, locus) task; process: one process '
+                        'per sample')
     p.add_argument('--log', choices=("INFO", "DEBUG"), default="INFO",
                    help='Print debug logs, DEBUG=verbose')
+    p.add_argument('--profile', action='store_true',
+                   help='Record per-stage timings and work counters of the '
+                        'Rust core in each JSON (<locus>.PROFILE-* keys)')
     p.add_argument('--tcell-fraction', action='store_true',
                    help='Also compute TcellExTRECT-style coverage fraction')
     p.add_argument('--targets', default=None,
@@ -76,6 +90,12 @@ def set_argparse():
                    help='Indexed FASTA reference (.fai alongside) — used to '
                         'build a per-locus in-memory BWA-MEM index for '
                         're-aligning soft-clipped reads')
+    p.add_argument('--index-cache', default=None,
+                   help='Directory of the persistent per-locus BWA index '
+                        'cache (default: $SPLITHUNTER_INDEX_CACHE or '
+                        '~/.cache/splithunter/bwa). Warm it ahead of a '
+                        'cohort run with splithunter_index')
+    set_io_opts(p)
     set_aws_opts(p)
     return p
 
@@ -102,15 +122,43 @@ def _bam_contigs(path):
         return set(bf.references)
 
 
-def analyze_bam(samplekey, bam, args, loci):
-    """Run the Rust core over each requested locus and return a result dict."""
-    result = {"SampleKey": samplekey, "bam": bam}
+# Loaded BWA indexes, reused across samples handled by this process.  The
+# indexes themselves are read-only mappings of the on-disk cache, so every
+# worker process shares the same physical pages.
+_REALIGNERS = {}
+
+
+def get_realigner(locus, chrom, reference, cache_dir=None):
+    key = (locus.name, chrom, locus.start, locus.end, reference, cache_dir)
+    if key not in _REALIGNERS:
+        _REALIGNERS[key] = _core.Realigner(
+            reference, locus.name, chrom, locus.start, locus.end,
+            cache_dir=cache_dir,
+        )
+    return _REALIGNERS[key]
+
+
+def _tcell_mask(args, locus_name, chrom):
+    if args.targets:
+        return load_exons_bed(args.targets, chrom)
+    if args.no_default_targets:
+        return None
+    return default_exons_for(locus_name, chrom)
+
+
+def plan_sample(samplekey, bam, args, loci):
+    """
+    Resolve the loci of one sample against its BAM header.  Returns
+    ``(specs, realigners, windows, masks)`` for ``_core.analyze_sample`` and
+    ``finish_sample``, or None when the sample cannot be analysed.
+    """
     try:
         contigs = _bam_contigs(bam)
     except Exception as e:
         logger.error("Cannot open BAM %s: %s", bam, e)
         return None
 
+    specs, realigners, windows, masks = [], [], {}, {}
     for locus in loci:
         try:
             chrom = pick_contig(locus, contigs)
@@ -119,50 +167,150 @@ def analyze_bam(samplekey, bam, args, loci):
             continue
         logger.debug("Analyzing %s @ %s:%d-%d", locus.name, chrom, locus.start, locus.end)
         try:
-            locus_result = _core.analyze_locus(
-                bam, locus.name, chrom, locus.start, locus.end,
-                args.reference,
-                args.pad, args.indel, args.min_entropy,
-            )
+            realigners.append(get_realigner(locus, chrom, args.reference,
+                                            args.index_cache))
         except Exception as e:
             logger.error("%s %s failed: %s", samplekey, locus.name, e)
             return None
-        result.update(locus_result)
-
+        specs.append((locus.name, chrom, locus.start, locus.end))
         if args.tcell_fraction and locus.name in HG38_TCELL_SEGMENTS:
             seg = HG38_TCELL_SEGMENTS[locus.name]._replace(chrom=chrom)
-            if args.targets:
-                mask = load_exons_bed(args.targets, chrom)
-            elif args.no_default_targets:
-                mask = None
-            else:
-                mask = default_exons_for(locus.name, chrom)
-            try:
-                tc = sh_tcell.estimate(
-                    bam,
-                    seg,
-                    min_mapq=1,
-                    min_cov=1,
-                    target_mask=mask,
-                    reference_fasta=args.reference,
-                )
-                for k, v in dict(tc).items():
-                    result[f"{locus.name}.TCELL-{k}"] = v
-                result[f"{locus.name}.TCELL-mask_intervals"] = (
-                    0 if not mask else len(mask)
-                )
-            except Exception as e:
-                logger.warning("%s %s fraction failed: %s", samplekey, locus.name, e)
+            masks[locus.name] = (seg, _tcell_mask(args, locus.name, chrom))
+            windows[locus.name] = sh_tcell.coverage_window(
+                seg, exon_mode=bool(masks[locus.name][1]))
+    return specs, realigners, windows, masks
+
+
+def analyze_bam(samplekey, bam, args, loci):
+    """
+    Run the Rust core over all requested loci in a single pass over the BAM
+    and return a result dict.  With ``--tcell-fraction`` the same pass also
+    collects the coverage tracks the TcellExTRECT estimator needs.
+    """
+    plan = plan_sample(samplekey, bam, args, loci)
+    if plan is None:
+        return None
+    specs, realigners, windows, masks = plan
+    if not specs:
+        return {"SampleKey": samplekey, "bam": bam}
+    try:
+        summary, coverage = _core.analyze_sample(
+            bam, specs, args.reference,
+            args.pad, args.indel, args.min_entropy,
+            realigners=realigners,
+            threads=args.threads,
+            coverage=windows,
+            min_mapq=1,
+            profile=args.profile,
+            **io_kwargs(args),
+        )
+    except Exception as e:
+        logger.error("%s failed: %s", samplekey, e)
+        return None
+    return finish_sample(samplekey, bam, args, summary, coverage, masks)
+
+
+def finish_sample(samplekey, bam, args, summary, coverage, masks):
+    """
+    Build the result dict of one sample from the Rust core's output, adding
+    the TcellExTRECT estimates computed from its coverage tracks.
+    """
+    result = {"SampleKey": samplekey, "bam": bam}
+    result.update(summary)
+
+    for name, (seg, mask) in masks.items():
+        pos, dep = coverage.get(name, ((), ()))
+        try:
+            tc = sh_tcell.estimate_from_coverage(
+                pos, dep, seg,
+                target_intervals=mask,
+                min_cov=1,
+                reference_fasta=args.reference,
+            )
+            for k, v in dict(tc).items():
+                result[f"{name}.TCELL-{k}"] = v
+            result[f"{name}.TCELL-mask_intervals"] = 0 if not mask else len(mask)
+            # Binned track for the HTML report, so it need not reread the BAM.
+            pos, dep = np.asarray(pos), np.asarray(dep)
+            full = (pos >= seg.full[0]) & (pos < seg.full[1])
+            result[f"{name}.{COVERAGE_BINS}"] = _bin_coverage(
+                pos[full], dep[full], seg.full[0], seg.full[1])
+        except Exception as e:
+            logger.warning("%s %s fraction failed: %s", samplekey, name, e)
 
     return result
 
 
+def _selected_loci(args):
+    if args.locus:
+        return [HG38_LOCI_BY_NAME[args.locus]]
+    return HG38_LOCI
+
+
 def run(arg):
     samplekey, bam, args = arg
-    loci = HG38_LOCI
-    if args.locus:
-        loci = [HG38_LOCI_BY_NAME[args.locus]]
-    return analyze_bam(samplekey, bam, args, loci)
+    return analyze_bam(samplekey, bam, args, _selected_loci(args))
+
+
+def run_cohort(samples, args, workers):
+    """
+    Analyze ``[(samplekey, bam), ...]`` with the native cohort scheduler:
+    every (sample, locus) pair is a task on ``workers`` threads sharing one
+    index per locus.  Yields each sample's result dict (or None on failure)
+    as soon as all of its loci are done.  The TcellExTRECT estimates run on a
+    pool of ``workers`` threads too, so they overlap the remaining scans
+    instead of serialising on the consuming thread.  Sample keys must be
+    unique: results are matched back to samples by key.
+    """
+    samples = list(samples)
+    repeated = sorted(k for k, n in Counter(k for k, _ in samples).items()
+                      if n > 1)
+    if repeated:
+        raise ValueError("duplicate sample keys: " + ", ".join(repeated))
+    loci = _selected_loci(args)
+    plans, inputs, realigners = {}, [], {}
+    for samplekey, bam in samples:
+        plan = plan_sample(samplekey, bam, args, loci)
+        if plan is None:
+            yield None
+            continue
+        specs, sample_realigners, windows, masks = plan
+        if not specs:
+            yield {"SampleKey": samplekey, "bam": bam}
+            continue
+        plans[samplekey] = (bam, masks)
+        inputs.append((samplekey, bam, specs, windows))
+        for r in sample_realigners:
+            realigners[id(r)] = r
+    if not inputs:
+        return
+
+    cohort = _core.analyze_cohort(
+        inputs, args.reference,
+        args.pad, args.indel, args.min_entropy,
+        realigners=list(realigners.values()),
+        workers=workers,
+        threads=args.threads,
+        min_mapq=1,
+        profile=args.profile,
+        **io_kwargs(args),
+    )
+    with ThreadPoolExecutor(max_workers=workers) as pool:
+        finishing = set()
+        for samplekey, summary, coverage, error in cohort:
+            bam, masks = plans[samplekey]
+            if error is not None:
+                logger.error("%s failed: %s", samplekey, error)
+                yield None
+            else:
+                finishing.add(pool.submit(finish_sample, samplekey, bam, args,
+                                          summary, coverage, masks))
+            done = {f for f in finishing if f.done()}
+            finishing -= done
+            for f in done:
+                yield f.result()
+        for f in as_completed(finishing):
+            yield f.result()
 
 
 def to_json(results):
@@ -257,11 +405,16 @@ def main(args=None):
             continue
         task_args.append((samplekey, bam, args))
 
-    cpus = min(args.cpus, len(task_args)) if task_args else 0
-    if cpus == 0:
+    if not task_args:
         logger.debug("All jobs already completed.")
+    elif args.scheduler == "native":
+        logger.debug("Starting %d threads for %d samples.", args.cpus, len(task_args))
+        pending = [(samplekey, bam) for samplekey, bam, _ in task_args]
+        for results in run_cohort(pending, args, args.cpus):
+            to_json(results)
     else:
-        logger.debug("Starting %d threads for %d jobs.", cpus, len(task_args))
+        cpus = min(args.cpus, len(task_args))
+        logger.debug("Starting %d processes for %d jobs.", cpus, len(task_args))
         if cpus == 1:
             for ta in task_args:
                 to_json(run(ta))
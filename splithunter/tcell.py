@@ -13,6 +13,10 @@ This module now exposes two code paths:
   exons, applies the per-exon running median filter, drops failed exons, then
   estimates the focal dip from a smoothed log-ratio track with a QC score.
 
+The exon-aware path runs natively (``_core.upstream_fraction_from_coverage``);
+``_estimate_upstream_from_coverage_df`` is kept as its pure Python/pandas
+reference implementation.
+
 The exon-aware path becomes the default whenever exon intervals are available
 for the analysed locus.  This matches the original TcellExTRECT semantics for
 WES/TRA runs.  Whole-window mode remains available for loci without vetted
@@ -34,7 +38,7 @@ from .loci import (
     default_exons_for,
     load_exons_bed,
 )
-from .utils import DefaultHelpParser
+from .utils import DefaultHelpParser, io_kwargs, set_io_opts
 
 
 def _empty_result(**extra):
@@ -64,12 +68,19 @@ def _clamp01(x):
     return x
 
 
-def _coverage_df_from_pairs(cov):
-    if not cov:
-        return pd.DataFrame({"pos": [], "reads": []}, dtype=float)
-    pos, reads = zip(*cov)
-    return pd.DataFrame({"pos": np.asarray(pos, dtype=np.int64),
-                         "reads": np.asarray(reads, dtype=float)})
+def _coverage_df(positions, depths):
+    return pd.DataFrame({"pos": np.asarray(positions, dtype=np.int64),
+                         "reads": np.asarray(depths, dtype=float)})
+
+
+def _exon_fetch_intervals(exons, full):
+    """Half-open fetch intervals for inclusive exon bounds, clipped to ``full``."""
+    out = []
+    for start, end in exons:
+        s, e = max(int(start), full[0]), min(int(end) + 1, full[1])
+        if s < e:
+            out.append((s, e))
+    return out
 
 
 def _interval_mask(pos, interval):
@@ -291,6 +302,41 @@ def _compute_gc_corrected_ratio(logr_df, segs, exons, reference_fasta, sliding=1
     return out, True
 
 
+def _estimate_upstream(
+    positions,
+    depths,
+    segs,
+    exons,
+    min_cov=1,
+    median_k=50,
+    median_thresh=15,
+    reference_fasta=None,
+):
+    positions = np.ascontiguousarray(positions, dtype=np.int64)
+    depths = np.ascontiguousarray(depths, dtype=np.float64)
+    # The native estimator walks the track as a sorted, gap-aware series.
+    # Callers may hand in any order; a repeated position keeps its first depth.
+    if positions.size > 1 and not np.all(np.diff(positions) > 0):
+        order = np.argsort(positions, kind="stable")
+        _, first = np.unique(positions[order], return_index=True)
+        positions = positions[order][first]
+        depths = depths[order][first]
+    return dict(_core.upstream_fraction_from_coverage(
+        positions,
+        depths,
+        segs.chrom,
+        segs.full,
+        segs.focal,
+        segs.left_baseline,
+        segs.right_baseline,
+        [(int(s), int(e)) for s, e in exons],
+        min_cov=min_cov,
+        median_k=median_k,
+        median_thresh=median_thresh,
+        reference_fasta=reference_fasta,
+    ))
+
+
 def _estimate_upstream_from_coverage_df(
     coverage_df,
     segs,
@@ -300,6 +346,10 @@ def _estimate_upstream_from_coverage_df(
     median_thresh=15,
     reference_fasta=None,
 ):
+    """
+    Reference implementation of ``_estimate_upstream``.  Far slower; kept
+    to cross-check the native estimator (see the tests).
+    """
     exon_df, removed = _select_exon_coverage(coverage_df, exons, median_k, median_thresh)
     if exon_df.empty or len(removed) > 30:
         return _empty_result(
@@ -421,6 +471,18 @@ def _estimate_upstream_from_coverage_df(
     }
 
 
+def coverage_window(segs, exon_mode):
+    """
+    Depth window ``(start, end)`` that ``estimate`` would read for ``segs``:
+    the full locus in exon mode, otherwise the span of the focal and both
+    baseline windows (the legacy whole-window estimator).
+    """
+    if exon_mode:
+        return segs.full
+    return (min(segs.left_baseline[0], segs.focal[0]),
+            max(segs.right_baseline[1], segs.focal[1]))
+
+
 def estimate_from_coverage(
     positions,
     depths,
@@ -431,13 +493,10 @@ def estimate_from_coverage(
     median_thresh=15,
     reference_fasta=None,
 ):
-    coverage_df = pd.DataFrame({
-        "pos": np.asarray(positions, dtype=np.int64),
-        "reads": np.asarray(depths, dtype=float),
-    })
     if target_intervals:
-        return _estimate_upstream_from_coverage_df(
-            coverage_df,
+        return _estimate_upstream(
+            positions,
+            depths,
             segs,
             list(target_intervals),
             min_cov=min_cov,
@@ -446,9 +505,11 @@ def estimate_from_coverage(
             reference_fasta=reference_fasta,
         )
 
+    # The binding reads int32 tracks (what region_coverage returns) in place
+    # and converts anything else itself.
     result = dict(_core.fraction_from_coverage(
-        list(map(int, positions)),
-        list(map(int, depths)),
+        positions,
+        depths,
         segs.focal[0], segs.focal[1],
         segs.left_baseline[0], segs.left_baseline[1],
         segs.right_baseline[0], segs.right_baseline[1],
@@ -469,6 +530,7 @@ def estimate(
     reference_fasta=None,
     median_k: int = 50,
     median_thresh: int = 15,
+    **io,
 ):
     """
     Return the TcellExTRECT-style summary dict for one locus.
@@ -479,19 +541,24 @@ def estimate(
     exon, removes low-depth exons, and estimates the focal dip from the exon
     log-ratio track.  If ``target_mask`` is absent the function falls back to
     the repo's original whole-window Rust shortcut.
+
+    Any further keyword arguments (``io_threads``, ``prefetch``, ...) set how
+    the BAM is read, as for ``_core.analyze_sample``; see ``utils.io_kwargs``.
     """
     mask_list = list(target_mask) if target_mask else None
     if mask_list:
-        cov = _core.region_coverage(
+        # Only exon positions feed the upstream estimator, so skip the
+        # intronic bulk of the locus altogether.
+        positions, depths = _core.region_coverage_many(
             bam_path,
             segs.chrom,
-            segs.full[0],
-            segs.full[1],
+            _exon_fetch_intervals(mask_list, segs.full),
             min_mapq,
+            **io,
         )
-        coverage_df = _coverage_df_from_pairs(cov)
-        return _estimate_upstream_from_coverage_df(
-            coverage_df,
+        return _estimate_upstream(
+            positions,
+            depths,
             segs,
             mask_list,
             min_cov=min_cov,
@@ -512,6 +579,7 @@ def estimate(
         min_mapq,
         min_cov,
         [],
+        **io,
     )
     out = dict(result)
     out["coverage_mode"] = "legacy-whole-window"
@@ -558,6 +626,7 @@ def main(args=None):
                         "exon targets, enable the GC-corrected upstream path.")
     p.add_argument("--json", action="store_true",
                    help="Emit a JSON object instead of a human summary")
+    set_io_opts(p)
     parsed = p.parse_args(args)
 
     segs = HG38_TCELL_SEGMENTS[parsed.locus]
@@ -582,6 +651,7 @@ def main(args=None):
         parsed.min_cov,
         mask,
         reference_fasta=parsed.reference,
+        **io_kwargs(parsed),
     )
     result["locus"] = parsed.locus
     result["bam"] = parsed.bam
@@ -16,6 +16,40 @@ class DefaultHelpParser(argparse.ArgumentParser):
         sys.exit(not self.print_help())
 
 
+def set_io_opts(p):
+    group = p.add_argument_group("BAM/CRAM I/O options (results do not depend "
+                                 "on these)")
+    group.add_argument("--io-threads", type=int, default=1,
+                       help="htslib threads decoding BGZF/CRAM blocks per "
+                            "open BAM")
+    group.add_argument("--prefetch", action="store_true",
+                       help="Look up the compressed byte ranges of every "
+                            "locus in the BAM index and read them ahead of "
+                            "decoding, a few large requests at a time. "
+                            "Mostly useful for remote (http/ftp) BAMs")
+    group.add_argument("--prefetch-gap", type=int, default=1024,
+                       help="Merge ranges at most this many KiB apart into "
+                            "one request")
+    group.add_argument("--prefetch-buffer", type=int, default=256,
+                       help="MiB of prefetched data held at once")
+    group.add_argument("--prefetch-requests", type=int, default=4,
+                       help="Concurrent prefetch requests per open BAM")
+
+
+def io_kwargs(args):
+    """
+    I/O keyword arguments of the ``_core`` functions that read a BAM
+    (``analyze_sample``, ``analyze_cohort``, ``region_coverage``, ...).
+    """
+    return dict(
+        io_threads=args.io_threads,
+        prefetch=args.prefetch,
+        prefetch_gap=args.prefetch_gap << 10,
+        prefetch_buffer=args.prefetch_buffer << 20,
+        prefetch_requests=args.prefetch_requests,
+    )
+
+
 def get_abs_path(path):
     return op.realpath(path)
 
@@ -3,9 +3,13 @@
 
 import csv
 import gzip
+import http.server
 import json
+import os
 import os.path as op
+import threading
 
+import numpy as np
 import pytest
 
 from splithunter import loci as sh_loci
@@ -65,6 +69,71 @@ def _locus_for(bam_contigs, name):
     return locus._replace(chrom=chrom)
 
 
+IO_KEYS = ("IO-BYTES-READ", "IO-REQUESTS", "IO-PREFETCH-HITS",
+           "IO-DECODE-SECONDS")
+
+
+def _without_io(summary):
+    """Drop the per-sample I/O counters, which vary from run to run."""
+    return {k: v for k, v in summary.items() if k not in IO_KEYS}
+
+
+class _RangeHandler(http.server.SimpleHTTPRequestHandler):
+    """Static files with single-range ``Range: bytes=a-[b]`` support, the
+    subset htslib's http client uses.  Counts range requests."""
+
+    ranges = 0
+
+    def log_message(self, *args):
+        pass
+
+    def do_GET(self):
+        spec = self.headers.get("Range")
+        if not spec:
+            return super().do_GET()
+        path = self.translate_path(self.path)
+        try:
+            size = os.path.getsize(path)
+        except OSError:
+            return self.send_error(404)
+        start, _, end = spec.split("=", 1)[1].partition("-")
+        start, end = int(start), min(int(end) if end else size - 1, size - 1)
+        if start >= size:
+            return self.send_error(416)
+        type(self).ranges += 1
+        self.send_response(206)
+        self.send_header("Content-Range", f"bytes {start}-{end}/{size}")
+        self.send_header("Content-Length", str(end - start + 1))
+        self.end_headers()
+        with open(path, "rb") as f:
+            f.seek(start)
+            left = end - start + 1
+            try:
+                while left:
+                    chunk = f.read(min(left, 1 << 16))
+                    self.wfile.write(chunk)
+                    left -= len(chunk)
+            except (BrokenPipeError, ConnectionResetError):
+                pass  # the client seeks away mid-body
+
+
+@pytest.fixture
+def http_tests_dir():
+    """Serve tests/ over HTTP on localhost; yields the base URL."""
+    handler = type("Handler", (_RangeHandler,), {"ranges": 0})
+    server = http.server.ThreadingHTTPServer(
+        ("127.0.0.1", 0),
+        lambda *a, **kw: handler(*a, directory=HERE, **kw))
+    server.handler = handler
+    thread = threading.Thread(target=server.serve_forever, daemon=True)
+    thread.start()
+    try:
+        yield server, f"http://127.0.0.1:{server.server_address[1]}"
+    finally:
+        server.shutdown()
+        server.server_close()
+
+
 def test_core_module_is_importable():
     from splithunter import _core
     assert hasattr(_core, "analyze_locus")
@@ -82,7 +151,10 @@ def test_analyze_locus_returns_expected_keys(bam_contigs, hg38_tra_reference):
         30, 10_000, 50.0,
     )
     for suffix in ("SR-TOTAL", "SR-SIGNAL", "SR-PPM", "SR-DETAILS",
-                   "SP-TOTAL", "SP-SIGNAL", "SP-PPM", "SP-DETAILS"):
+                   "SP-TOTAL", "SP-SIGNAL", "SP-PPM", "SP-DETAILS",
+                   "SP-PEAK-PENDING", "SP-PEAK-BYTES",
+                   "SR-PRESCREENED", "SR-LOWCOMPLEXITY",
+                   "SR-CACHE-HITS", "SR-CACHE-MISSES"):
         assert f"TRA.{suffix}" in result
     assert isinstance(result["TRA.SR-TOTAL"], int)
     assert isinstance(result["TRA.SR-PPM"], float)
@@ -111,20 +183,240 @@ def test_analyze_locus_detects_split_reads(bam_contigs, hg38_tra_reference):
     ) > 0, "no SR/SP evidence detected"
 
 
+def test_cached_realigner_matches_per_call_index(tmp_path, bam_contigs,
+                                               hg38_tra_reference):
+    from splithunter import _core
+
+    locus = _locus_for(bam_contigs, "TRA")
+    cache_dir = str(tmp_path / "bwa")
+    realigner = _core.Realigner(
+        hg38_tra_reference, locus.name, locus.chrom, locus.start, locus.end,
+        cache_dir=cache_dir,
+    )
+    assert realigner.index_path.startswith(cache_dir)
+    assert realigner.chrom == locus.chrom
+    assert _core.prebuild_index(
+        hg38_tra_reference, locus.name, locus.chrom, locus.start, locus.end,
+        cache_dir=cache_dir,
+    ) == realigner.index_path
+
+    args = (TEST_BAM, locus.name, locus.chrom, locus.start, locus.end,
+            hg38_tra_reference, 30, 10_000, 50.0)
+    cached = _core.analyze_locus(*args, realigner=realigner)
+    fresh = _core.analyze_locus(*args)
+    assert cached == fresh
+    with pytest.raises(ValueError):
+        _core.analyze_locus(TEST_BAM, "TRB", locus.chrom, locus.start,
+                            locus.end, hg38_tra_reference,
+                            realigner=realigner)
+    with pytest.raises(ValueError):
+        _core.analyze_locus(TEST_BAM, locus.name, "chrUn", locus.start,
+                            locus.end, hg38_tra_reference,
+                            realigner=realigner)
+
+
+def test_analyze_locus_threads_do_not_change_output(bam_contigs,
+                                                    hg38_tra_reference):
+    from splithunter import _core
+
+    locus = _locus_for(bam_contigs, "TRA")
+    args = (TEST_BAM, locus.name, locus.chrom, locus.start, locus.end,
+            hg38_tra_reference, 30, 10_000, 50.0)
+    assert _core.analyze_locus(*args, threads=4) == \
+        _core.analyze_locus(*args, threads=1)
+
+
+def test_profile_is_opt_in_and_leaves_results_unchanged(bam_contigs,
+                                                        hg38_tra_reference):
+    from splithunter import _core
+
+    locus = _locus_for(bam_contigs, "TRA")
+    args = (TEST_BAM, locus.name, locus.chrom, locus.start, locus.end,
+            hg38_tra_reference, 30, 10_000, 50.0)
+    plain = _core.analyze_locus(*args)
+    profiled = _core.analyze_locus(*args, profile=True)
+    assert not any(".PROFILE-" in k for k in plain)
+    stats = {k: v for k, v in profiled.items() if ".PROFILE-" in k}
+    assert {k: v for k, v in profiled.items() if k not in stats} == plain
+    for stage in ("INDEX", "FETCH", "DECODE", "SOFTCLIP", "PRESCREEN",
+                  "REALIGN", "ENTROPY", "PAIRSCAN"):
+        assert stats[f"TRA.PROFILE-{stage}-SECONDS"] >= 0.0
+    assert stats["TRA.PROFILE-READS-SCANNED"] >= plain["TRA.SR-TOTAL"]
+    # At most the whole read and its two halves go to BWA, and only on a
+    # cache miss.
+    calls = stats["TRA.PROFILE-MEM-ALIGN1-CALLS"]
+    assert 0 < calls <= plain["TRA.SR-CACHE-MISSES"]
+    assert calls <= 3 * stats["TRA.PROFILE-READS-REALIGNED"]
+    assert stats["TRA.PROFILE-PEAK-PAIR-CACHE"] == \
+        plain["TRA.SP-PEAK-PENDING"]
+
+
+def test_analyze_sample_matches_per_locus_calls(bam_contigs,
+                                                hg38_tra_reference):
+    from splithunter import _core
+
+    locus = _locus_for(bam_contigs, "TRA")
+    segs = sh_loci.HG38_TCELL_SEGMENTS["TRA"]
+    window = sh_tcell.coverage_window(segs, exon_mode=False)
+    summary, coverage = _core.analyze_sample(
+        TEST_BAM, [(locus.name, locus.chrom, locus.start, locus.end)],
+        hg38_tra_reference, 30, 10_000, 50.0,
+        coverage={"TRA": window},
+    )
+    assert all(k in summary for k in IO_KEYS)
+    assert _without_io(summary) == _core.analyze_locus(
+        TEST_BAM, locus.name, locus.chrom, locus.start, locus.end,
+        hg38_tra_reference, 30, 10_000, 50.0,
+    )
+    positions, depths = coverage["TRA"]
+    expect_pos, expect_dep = _core.region_coverage(
+        TEST_BAM, locus.chrom, window[0], window[1], 1)
+    assert np.array_equal(positions, expect_pos)
+    assert np.array_equal(depths, expect_dep)
+
+
+def test_analyze_cohort_streams_each_sample(tmp_path, bam_contigs,
+                                            hg38_tra_reference):
+    from splithunter import _core
+
+    tra = _locus_for(bam_contigs, "TRA")
+    # The reference fixture only carries TRA; a sub-window of it stands in
+    # for a second locus.
+    loci = [(tra.name, tra.chrom, tra.start, tra.end),
+            ("TRA-5P", tra.chrom, tra.start, tra.start + 200_000)]
+    segs = sh_loci.HG38_TCELL_SEGMENTS["TRA"]
+    windows = {"TRA": sh_tcell.coverage_window(segs, exon_mode=False)}
+    expect_summary, expect_coverage = _core.analyze_sample(
+        TEST_BAM, loci, hg38_tra_reference, 30, 10_000, 50.0,
+        coverage=windows,
+    )
+
+    samples = [("a", TEST_BAM, loci, windows),
+               ("missing", str(tmp_path / "missing.bam"), loci, None),
+               ("b", TEST_BAM, loci, windows)]
+    results = {key: (summary, coverage, error) for key, summary, coverage, error
+               in _core.analyze_cohort(samples, hg38_tra_reference,
+                                       30, 10_000, 50.0, workers=3)}
+    assert sorted(results) == ["a", "b", "missing"]
+
+    with pytest.raises(ValueError):
+        _core.analyze_cohort(samples + [("a", TEST_BAM, loci, windows)],
+                             hg38_tra_reference, 30, 10_000, 50.0)
+    unused = _core.Realigner(hg38_tra_reference, "TRA-3P", tra.chrom,
+                             tra.end - 200_000, tra.end,
+                             cache_dir=str(tmp_path / "bwa"))
+    with pytest.raises(ValueError):
+        _core.analyze_cohort(samples, hg38_tra_reference, 30, 10_000, 50.0,
+                             realigners=[unused])
+
+    summary, coverage, error = results["missing"]
+    assert summary is None and coverage is None and error
+    for key in ("a", "b"):
+        summary, coverage, error = results[key]
+        assert error is None
+        assert _without_io(summary) == _without_io(expect_summary)
+        assert sorted(coverage) == ["TRA"]
+        for got, expect in zip(coverage["TRA"], expect_coverage["TRA"]):
+            assert np.array_equal(got, expect)
+
+
+def test_prefetch_over_http_matches_local_scan(bam_contigs, hg38_tra_reference,
+                                              http_tests_dir):
+    from splithunter import _core
+
+    server, base = http_tests_dir
+    tra = _locus_for(bam_contigs, "TRA")
+    loci = [(tra.name, tra.chrom, tra.start, tra.end),
+            ("TRA-5P", tra.chrom, tra.start, tra.start + 200_000)]
+    segs = sh_loci.HG38_TCELL_SEGMENTS["TRA"]
+    windows = {"TRA": sh_tcell.coverage_window(segs, exon_mode=False)}
+    args = (loci, hg38_tra_reference, 30, 10_000, 50.0)
+    expect_summary, expect_coverage = _core.analyze_sample(
+        TEST_BAM, *args, coverage=windows)
+    # Not measured without prefetch, so not reported as zero either.
+    assert expect_summary["IO-BYTES-READ"] is None
+    assert expect_summary["IO-REQUESTS"] is None
+
+    url = f"{base}/{op.basename(TEST_BAM)}"
+    for source, kwargs in (
+            (TEST_BAM, dict(prefetch=True, io_threads=2)),
+            (url, dict()),
+            (url, dict(prefetch=True, io_threads=2, prefetch_requests=3)),
+            # A tiny buffer and no merging: many small ranges, same answer.
+            (url, dict(prefetch=True, prefetch_gap=0,
+                       prefetch_buffer=1 << 16))):
+        summary, coverage = _core.analyze_sample(
+            source, *args, coverage=windows, **kwargs)
+        assert _without_io(summary) == _without_io(expect_summary), kwargs
+        for got, expect in zip(coverage["TRA"], expect_coverage["TRA"]):
+            assert np.array_equal(got, expect)
+        assert summary["IO-DECODE-SECONDS"] > 0
+        if kwargs.get("prefetch"):
+            assert summary["IO-BYTES-READ"] > 0
+            assert summary["IO-PREFETCH-HITS"] > 0
+            assert summary["IO-REQUESTS"] > 0
+        else:
+            assert summary["IO-BYTES-READ"] is None
+            assert summary["IO-REQUESTS"] is None
+    assert server.handler.ranges > 0
+
+    # Merging nearby ranges never takes more requests.
+    summary, _ = _core.analyze_sample(url, *args, coverage=windows,
+                                      prefetch=True)
+    merged = summary["IO-REQUESTS"]
+    summary, _ = _core.analyze_sample(url, *args, coverage=windows,
+                                      prefetch=True, prefetch_gap=0)
+    assert merged <= summary["IO-REQUESTS"]
+
+    results = list(_core.analyze_cohort(
+        [("http", url, loci, windows)], hg38_tra_reference, 30, 10_000, 50.0,
+        workers=2, prefetch=True))
+    [(key, summary, coverage, error)] = results
+    assert error is None
+    assert _without_io(summary) == _without_io(expect_summary)
+    assert summary["IO-BYTES-READ"] > 0
+
+
 def test_region_coverage_is_sorted(bam_contigs):
     from splithunter import _core
 
     locus = _locus_for(bam_contigs, "TRA")
     window = 5_000
-    cov = _core.region_coverage(
+    positions, depths = _core.region_coverage(
         TEST_BAM, locus.chrom, locus.start, locus.start + window, 0,
     )
-    positions = [p for p, _ in cov]
-    assert positions == sorted(positions)
+    assert positions.dtype == np.int32 and depths.dtype == np.int32
+    assert len(positions) == len(depths)
+    assert np.all(np.diff(positions) > 0)
     # The sample BAM is sparse — we only require that covered positions fall
     # within the fetched window.
-    for pos, _ in cov:
-        assert locus.start <= pos < locus.start + window
+    assert np.all((positions >= locus.start) & (positions < locus.start + window))
+
+
+def test_region_coverage_many_matches_single_window(bam_contigs):
+    from splithunter import _core
+
+    locus = _locus_for(bam_contigs, "TRA")
+    s = locus.start
+    # Unsorted, overlapping and far-apart intervals in one call.
+    intervals = [(s + 300_000, s + 300_500), (s, s + 2_000), (s + 1_500, s + 3_000)]
+    positions, depths = _core.region_coverage_many(
+        TEST_BAM, locus.chrom, intervals, 1)
+    assert np.all(np.diff(positions) > 0)
+
+    expect_pos, expect_dep = [], []
+    for start, end in [(s, s + 3_000), (s + 300_000, s + 300_500)]:
+        p, d = _core.region_coverage(TEST_BAM, locus.chrom, start, end, 1)
+        expect_pos.append(p)
+        expect_dep.append(d)
+    assert np.array_equal(positions, np.concatenate(expect_pos))
+    assert np.array_equal(depths, np.concatenate(expect_dep))
+
+    fetched = _core.region_coverage_many(
+        TEST_BAM, locus.chrom, intervals, 1,
+        io_threads=2, prefetch=True, prefetch_gap=0, prefetch_requests=2)
+    assert np.array_equal(fetched[0], positions)
+    assert np.array_equal(fetched[1], depths)
 
 
 def test_tcell_fraction_within_bounds(bam_contigs):
@@ -143,6 +435,7 @@ def test_run_pipeline_produces_json(tmp_path, bam_contigs, hg38_tra_reference):
     sh_run.main([
         SAMPLES_CSV, "--workdir", str(workdir), "--locus", "TRA",
         "--reference", hg38_tra_reference,
+        "--index-cache", str(tmp_path / "bwa"),
     ])
     outputs = list(workdir.glob("*.json"))
     assert outputs, "splithunter produced no JSON output"
@@ -152,11 +445,36 @@ def test_run_pipeline_produces_json(tmp_path, bam_contigs, hg38_tra_reference):
     assert "TRA.SR-TOTAL" in payload
 
 
+def test_native_and_process_schedulers_agree(tmp_path, bam_contigs,
+                                            hg38_tra_reference):
+    samples = tmp_path / "samples.csv"
+    samples.write_text("#SampleKey,BAM\n" + "".join(
+        f"NA12878-{i},{op.abspath(TEST_BAM)}\n" for i in range(3)))
+    payloads = {}
+    for scheduler in ("native", "process"):
+        workdir = tmp_path / scheduler
+        sh_run.main([
+            str(samples), "--workdir", str(workdir), "--locus", "TRA",
+            "--reference", hg38_tra_reference,
+            "--index-cache", str(tmp_path / "bwa"),
+            "--scheduler", scheduler, "--cpus", "2",
+        ])
+        payloads[scheduler] = {}
+        for path in workdir.glob("*.json"):
+            with open(path) as fp:
+                payloads[scheduler][path.name] = _without_io(json.load(fp))
+    assert len(payloads["native"]) == 3
+    assert payloads["native"] == payloads["process"]
+    with pytest.raises(ValueError):
+        next(sh_run.run_cohort([("x", TEST_BAM), ("x", TEST_BAM)], None, 1))
+
+
 def test_report_from_run(tmp_path, bam_contigs, hg38_tra_reference):
     workdir = tmp_path / "work"
     sh_run.main([
         SAMPLES_CSV, "--workdir", str(workdir), "--locus", "TRA",
         "--reference", hg38_tra_reference,
+        "--index-cache", str(tmp_path / "bwa"),
     ])
     tsvfile = tmp_path / "out.tsv"
     jsonfiles = [str(p) for p in workdir.glob("*.json")]
@@ -408,6 +726,98 @@ def test_upstream_exon_pipeline_reports_qc_and_exon_counts():
     assert result["tcell_fraction"] == pytest.approx(0.1844, abs=0.05)
 
 
+def _assert_same_estimate(native, reference):
+    # Documented tolerance of the native estimator: floats agree to 1e-9
+    # relative (only summation order differs), everything else exactly.
+    assert set(native) == set(reference)
+    for key, want in reference.items():
+        if isinstance(want, float):
+            assert native[key] == pytest.approx(want, rel=1e-9, abs=1e-12, nan_ok=True), key
+        else:
+            assert native[key] == want, key
+
+
+def test_native_upstream_matches_python_on_cov_example():
+    pos, dep = _load_cov_example()
+    segs = _load_seg("hg19")
+    exons = sh_loci.load_exons_bed(
+        op.join(FIXTURES, "tcra_exons_hg19.bed"), "chr14")
+    seg = sh_loci.LocusSegments(
+        "TRA", "chr14",
+        segs["all"], segs["focal"], segs["local1"], segs["local2"],
+    )
+    for min_cov in (0, 1):
+        native = sh_tcell._estimate_upstream(pos, dep, seg, exons, min_cov=min_cov)
+        reference = sh_tcell._estimate_upstream_from_coverage_df(
+            sh_tcell._coverage_df(pos, dep), seg, exons, min_cov=min_cov)
+        _assert_same_estimate(native, reference)
+
+
+def test_native_upstream_accepts_unsorted_and_repeated_positions():
+    pos, dep = _load_cov_example()
+    pos, dep = np.asarray(pos), np.asarray(dep)
+    segs = _load_seg("hg19")
+    exons = sh_loci.load_exons_bed(
+        op.join(FIXTURES, "tcra_exons_hg19.bed"), "chr14")
+    seg = sh_loci.LocusSegments(
+        "TRA", "chr14",
+        segs["all"], segs["focal"], segs["local1"], segs["local2"],
+    )
+    expect = sh_tcell._estimate_upstream(pos, dep, seg, exons)
+    order = np.random.default_rng(7).permutation(len(pos))
+    shuffled = sh_tcell._estimate_upstream(pos[order], dep[order], seg, exons)
+    _assert_same_estimate(shuffled, expect)
+    repeated = sh_tcell._estimate_upstream(
+        np.concatenate([pos, pos[::3]]), np.concatenate([dep, dep[::3] + 100]),
+        seg, exons)
+    _assert_same_estimate(repeated, expect)
+
+
+def test_native_upstream_gc_correction_matches_python(hg38_tra_reference):
+    seg = sh_loci.HG38_TCELL_SEGMENTS["TRA"]
+    exons = sh_loci.load_exons_bed(sh_loci.DEFAULT_EXONS_BED, "chr14")[::4]
+    pos, dep = [], []
+    for i, (start, end) in enumerate(sorted(exons)):
+        for p in range(max(start, pos[-1] + 1 if pos else start), end + 1):
+            pos.append(p)
+            dep.append(30 + (i * 7) % 25 + (p * 2654435761 >> 9) % 23)
+    native = sh_tcell._estimate_upstream(
+        pos, dep, seg, exons, reference_fasta=hg38_tra_reference)
+    reference = sh_tcell._estimate_upstream_from_coverage_df(
+        sh_tcell._coverage_df(pos, dep), seg, exons,
+        reference_fasta=hg38_tra_reference)
+    assert native["gc_corrected"] is True
+    _assert_same_estimate(native, reference)
+
+
+def test_native_upstream_reports_failures():
+    from splithunter import _core
+
+    seg = sh_loci.LocusSegments(
+        "TRA", "chr14", (0, 100), (40, 60), (0, 20), (80, 100))
+    pos = list(range(101))
+    dep = [50] * 101
+    for exons, thresh, reason in (
+        ([(0, 10), (90, 100)], 100, "no_usable_exons"),
+        ([(30, 45)], 1, "no_baseline_positions"),
+    ):
+        native = sh_tcell._estimate_upstream(
+            pos, dep, seg, exons, median_thresh=thresh)
+        reference = sh_tcell._estimate_upstream_from_coverage_df(
+            sh_tcell._coverage_df(pos, dep), seg, exons, median_thresh=thresh)
+        assert native["failure_reason"] == reason
+        _assert_same_estimate(native, reference)
+    # The binding itself still rejects an unsorted track; _estimate_upstream
+    # sorts before calling it.
+    with pytest.raises(ValueError):
+        _core.upstream_fraction_from_coverage(
+            np.array([2, 1], dtype=np.int64),
+            np.array([5.0, 5.0], dtype=np.float64),
+            seg.chrom, seg.full, seg.focal,
+            seg.left_baseline, seg.right_baseline, [(0, 10)],
+            min_cov=1, median_k=50, median_thresh=15)
+
+
 def test_upstream_exon_pipeline_ignores_intronic_spike():
     from splithunter import _core
 